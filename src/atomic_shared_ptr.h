@@ -1,28 +1,160 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstdlib>
 #include <memory>
 #include <thread>
 #include <stack>
+#include <vector>
 
 #include "fast_logger.h"
+#include "latency_histogram.h"
+#include "pointer_stats.h"
 
 namespace LFStructs {
 
 const int MAGIC_LEN = 16;
 const size_t MAGIC_MASK = 0x0000'0000'0000'FFFF;
 const int CACHE_LINE_SIZE = 128;
+static_assert(alignof(Stats::ThreadStats) == CACHE_LINE_SIZE, "per-thread stats should take whole cache lines");
+
+/* Alignment of ControlBlock, AtomicSharedPtr and FastSharedPtr: 0 (dense), 64 or 128.
+ * They are embedded into every tree and queue node, so padding them to cache line
+ * costs hundreds of bytes per element. Containers align their roots to
+ * CACHE_LINE_SIZE themselves, so dense is the default. */
+#ifndef LFSTRUCTS_PADDING
+#define LFSTRUCTS_PADDING 0
+#endif
+static_assert(LFSTRUCTS_PADDING == 0 || LFSTRUCTS_PADDING == 64 || LFSTRUCTS_PADDING == 128,
+              "LFSTRUCTS_PADDING should be 0, 64 or 128");
+const size_t PADDED_ALIGNMENT = LFSTRUCTS_PADDING == 0 ? alignof(size_t) : LFSTRUCTS_PADDING;
+
+/* Counting of live control blocks and objects for allocationStats(). It costs
+ * two shared atomic updates per ControlBlock, so it is off unless requested. */
+#ifndef ALLOCATION_STATS_ENABLED
+#define ALLOCATION_STATS_ENABLED 0
+#endif
+
+/* Counter which stays one atomic until threads fight for it. First failed
+ * CAS allocates cache line sized stripes, one per hardware thread up to
+ * MAX_STRIPE_COUNT, and from then on every thread adds to its own stripe
+ * (given out round-robin). So a container which is never contended pays
+ * 16 bytes instead of a whole stripe block. load() sums everything without
+ * locking: exact once writers are done, approximate while they run. */
+class StripedCounter {
+public:
+    static const int MAX_STRIPE_COUNT = 16;
+
+    StripedCounter() = default;
+    StripedCounter(const StripedCounter&) = delete;
+    StripedCounter& operator=(const StripedCounter&) = delete;
+    ~StripedCounter() {
+        delete[] stripes.load(std::memory_order_relaxed);
+    }
+
+    void add(long long delta) {
+        Stripe *current = stripes.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            long long value = base.load(std::memory_order_relaxed);
+            if (base.compare_exchange_strong(value, value + delta, std::memory_order_relaxed))
+                return;
+
+            current = allocateStripes();
+        }
+
+        current[stripeIndex()].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    long long load() const {
+        long long res = base.load(std::memory_order_relaxed);
+        const Stripe *current = stripes.load(std::memory_order_acquire);
+        if (current != nullptr)
+            for (size_t i = 0; i < stripeCount(); i++)
+                res += current[i].value.load(std::memory_order_relaxed);
+        return res;
+    }
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Stripe {
+        std::atomic<long long> value = 0;
+    };
+
+    static size_t stripeCount() {
+        static const size_t count = std::min<size_t>(MAX_STRIPE_COUNT, std::max(1u, std::thread::hardware_concurrency()));
+        return count;
+    }
+
+    static size_t stripeIndex() {
+        static std::atomic<size_t> nextStripe = 0;
+        thread_local size_t index = nextStripe.fetch_add(1, std::memory_order_relaxed) % stripeCount();
+        return index;
+    }
+
+    Stripe* allocateStripes() {
+        Stripe *fresh = new Stripe[stripeCount()];
+        Stripe *expected = nullptr;
+        if (stripes.compare_exchange_strong(expected, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+            return fresh;
+
+        delete[] fresh;
+        return expected;
+    }
+
+    std::atomic<long long> base = 0;
+    std::atomic<Stripe*> stripes = nullptr;
+};
+
+struct AllocationStats {
+    // control blocks alive, including ones which own nullptr
+    long long controlBlocks;
+    // objects owned by them, that is nodes of every container
+    long long objects;
+};
+
+#if ALLOCATION_STATS_ENABLED
+// never destroyed, control blocks may outlive static destructors
+inline StripedCounter& liveControlBlocks() {
+    static StripedCounter *counter = new StripedCounter();
+    return *counter;
+}
+
+inline StripedCounter& liveObjects() {
+    static StripedCounter *counter = new StripedCounter();
+    return *counter;
+}
+#endif
+
+// zeros unless compiled with ALLOCATION_STATS_ENABLED
+inline AllocationStats allocationStats() {
+#if ALLOCATION_STATS_ENABLED
+    return {liveControlBlocks().load(), liveObjects().load()};
+#else
+    return {0, 0};
+#endif
+}
 
 template<typename T>
-struct alignas(CACHE_LINE_SIZE) ControlBlock {
+struct alignas(PADDED_ALIGNMENT) ControlBlock {
     explicit ControlBlock() = delete;
     explicit ControlBlock(T *data)
         : data(data)
         , refCount(1)
     {
         assert(reinterpret_cast<size_t>(data) <= 0x0000'FFFF'FFFF'FFFF);
+#if ALLOCATION_STATS_ENABLED
+        liveControlBlocks().add(1);
+        if (data != nullptr)
+            liveObjects().add(1);
+#endif
+    }
+    ~ControlBlock() {
+#if ALLOCATION_STATS_ENABLED
+        liveControlBlocks().add(-1);
+        if (data != nullptr)
+            liveObjects().add(-1);
+#endif
     }
 
     T *data;
@@ -45,7 +177,7 @@ public:
         if (controlBlock != nullptr) {
             int before = controlBlock->refCount.fetch_add(1);
             assert(before);
-            FAST_LOG(Operation::Ref, (reinterpret_cast<size_t>(controlBlock) << MAGIC_LEN / 2) | before);
+            FAST_LOG(Operation::Ref, reinterpret_cast<size_t>(controlBlock), before);
         }
     };
     SharedPtr(SharedPtr &&other) noexcept {
@@ -58,7 +190,7 @@ public:
         if (controlBlock != nullptr) {
             int before = controlBlock->refCount.fetch_add(1);
             assert(before);
-            FAST_LOG(Operation::Ref, (reinterpret_cast<size_t>(controlBlock) << MAGIC_LEN / 2) | before);
+            FAST_LOG(Operation::Ref, reinterpret_cast<size_t>(controlBlock), before);
         }
         unref(old);
         return *this;
@@ -77,6 +209,10 @@ public:
         thread_local bool destructionInProgress = false;
 
         destructionQueue.push_back(controlBlock);
+        if (destructionInProgress && controlBlock != nullptr) {
+            POINTER_STATS_ADD(DeferredDestructions, 1);
+            POINTER_STATS_MAX(MaxDestructionQueue, destructionQueue.size());
+        }
         if (!destructionInProgress) {
             destructionInProgress = true;
             while (destructionQueue.size()) {
@@ -97,7 +233,7 @@ private:
         if (blockToUnref) {
             int before = blockToUnref->refCount.fetch_sub(1);
             assert(before);
-            FAST_LOG(Operation::Unref, (reinterpret_cast<size_t>(blockToUnref) << MAGIC_LEN / 2) | before);
+            FAST_LOG(Operation::Unref, reinterpret_cast<size_t>(blockToUnref), before);
             if (before == 1) {
                 FAST_LOG(Operation::ObjectDestroyed, reinterpret_cast<size_t>(blockToUnref));
                 delete blockToUnref->data;
@@ -112,7 +248,7 @@ private:
 
 
 template<typename T>
-class alignas(CACHE_LINE_SIZE) FastSharedPtr {
+class alignas(PADDED_ALIGNMENT) FastSharedPtr {
 public:
     FastSharedPtr(const FastSharedPtr<T> &other) = delete;
     FastSharedPtr(FastSharedPtr<T> &&other)
@@ -137,6 +273,14 @@ public:
     ControlBlock<T>* getControlBlock() { return reinterpret_cast<ControlBlock<T>*>(knownValue >> MAGIC_LEN); }
     T* get() { return data; }
     T* operator->(){ return data; }
+    // own reference, which stays valid after AtomicSharedPtr it was read from is gone
+    SharedPtr<T> toShared() {
+        ControlBlock<T> *block = getControlBlock();
+        int before = block->refCount.fetch_add(1);
+        assert(before);
+        FAST_LOG(Operation::Ref, reinterpret_cast<size_t>(block), before);
+        return SharedPtr<T>(block);
+    }
 private:
     void destroy() {
         if (foreignPackedPtr != nullptr) {
@@ -164,6 +308,7 @@ private:
         while (diff > 1000 && block == getControlBlock()) {
             block->refCount.fetch_add(diff);
             if (packedPtr->compare_exchange_strong(knownValue, knownValue - diff)) {
+                POINTER_STATS_ADD(LocalRefTransfers, 1);
                 foreignPackedPtr = nullptr;
                 break;
             }
@@ -181,7 +326,7 @@ private:
 
 
 template<typename T>
-class alignas(CACHE_LINE_SIZE) AtomicSharedPtr {
+class alignas(PADDED_ALIGNMENT) AtomicSharedPtr {
 public:
     AtomicSharedPtr(T *data = nullptr);
     ~AtomicSharedPtr();
@@ -219,7 +364,7 @@ template<typename T>
 SharedPtr<T> AtomicSharedPtr<T>::get() {
     // taking copy and notifying about read in progress
     size_t packedPtrCopy = packedPtr.fetch_add(1);
-    FAST_LOG(Operation::Get, packedPtrCopy);
+    FAST_LOG(Operation::Get, packedPtrCopy >> MAGIC_LEN, packedPtrCopy & MAGIC_MASK);
     auto block = reinterpret_cast<ControlBlock<T>*>(packedPtrCopy >> MAGIC_LEN);
     int before = block->refCount.fetch_add(1);
     assert(before);
@@ -231,7 +376,7 @@ SharedPtr<T> AtomicSharedPtr<T>::get() {
         assert((expected & MAGIC_MASK) > 0);
         size_t expCopy = expected;
         if (packedPtr.compare_exchange_weak(expected, expected - 1)) {
-            FAST_LOG(Operation::GetRefSucc, expected);
+            FAST_LOG(Operation::GetRefSucc, expected >> MAGIC_LEN, expected & MAGIC_MASK);
             break;
         }
 
@@ -242,8 +387,9 @@ SharedPtr<T> AtomicSharedPtr<T>::get() {
         {
             int before = block->refCount.fetch_sub(1);
             assert(before);
-            FAST_LOG(Operation::Unref, before);
-            FAST_LOG(Operation::GetRefAbrt, packedPtrCopy);
+            FAST_LOG(Operation::Unref, reinterpret_cast<size_t>(block), before);
+            FAST_LOG(Operation::GetRefAbrt, packedPtrCopy >> MAGIC_LEN, packedPtrCopy & MAGIC_MASK);
+            POINTER_STATS_ADD(GetAborts, 1);
             break;
         }
 
@@ -275,6 +421,10 @@ AtomicSharedPtr<T>::~AtomicSharedPtr() {
     }
 
     destructionQueue.push_back(packedPtrCopy);
+    if (destructionInProgress) {
+        POINTER_STATS_ADD(DeferredDestructions, 1);
+        POINTER_STATS_MAX(MaxDestructionQueue, destructionQueue.size());
+    }
     if (!destructionInProgress) {
         destructionInProgress = true;
         while (destructionQueue.size()) {
@@ -306,6 +456,11 @@ bool AtomicSharedPtr<T>::compareExchange(T *expected, SharedPtr<T> &&newOne) {
     if (expected == newOne.get()) {
         return true;
     }
+    if (newOne.controlBlock == nullptr) {
+        // empty SharedPtr has no control block, but packedPtr must always point to one
+        newOne = SharedPtr<T>(static_cast<T*>(nullptr));
+    }
+    POINTER_STATS_ADD(CasAttempts, 1);
     auto holder = this->getFast();
     FAST_LOG(Operation::CompareAndSwap, reinterpret_cast<size_t>(holder.getControlBlock()));
     if (holder.get() == expected) {
@@ -316,14 +471,15 @@ bool AtomicSharedPtr<T>::compareExchange(T *expected, SharedPtr<T> &&newOne) {
             if (expectedPackedPtr & MAGIC_MASK) {
                 int diff = expectedPackedPtr & MAGIC_MASK;
                 holder.getControlBlock()->refCount.fetch_add(diff);
-                if (!packedPtr.compare_exchange_weak(expectedPackedPtr, expectedPackedPtr & ~MAGIC_MASK)) {
+                if (!packedPtr.compare_exchange_weak(expectedPackedPtr, expectedPackedPtr & ~MAGIC_MASK))
                     holder.getControlBlock()->refCount.fetch_sub(diff);
-                }
+                else
+                    POINTER_STATS_ADD(CasRefTransfers, 1);
                 continue;
             }
             assert((expectedPackedPtr >> MAGIC_LEN) != (desiredPackedPtr >> MAGIC_LEN));
             if (packedPtr.compare_exchange_weak(expectedPackedPtr, desiredPackedPtr)) {
-                FAST_LOG(Operation::GetInCAS, expectedPackedPtr);
+                FAST_LOG(Operation::GetInCAS, expectedPackedPtr >> MAGIC_LEN, expectedPackedPtr & MAGIC_MASK);
                 newOne.controlBlock = nullptr;
                 assert((expectedPackedPtr >> MAGIC_LEN) == holdedPtr);
                 destroyOldControlBlock(expectedPackedPtr);
@@ -333,24 +489,25 @@ bool AtomicSharedPtr<T>::compareExchange(T *expected, SharedPtr<T> &&newOne) {
     }
 
     FAST_LOG(Operation::CASAbrt, reinterpret_cast<size_t>(holder.get()));
+    POINTER_STATS_ADD(CasFailures, 1);
     return false;
 }
 
 template<typename T>
 void AtomicSharedPtr<T>::destroyOldControlBlock(size_t oldPackedPtr) {
-    FAST_LOG(Operation::CASDestructed, oldPackedPtr);
+    FAST_LOG(Operation::CASDestructed, oldPackedPtr >> MAGIC_LEN, oldPackedPtr & MAGIC_MASK);
 //    assert((oldPackedPtr & MAGIC_MASK) == 0);
 
     auto block = reinterpret_cast<ControlBlock<T>*>(oldPackedPtr >> MAGIC_LEN);
     auto refCountBefore = block->refCount.fetch_sub(1);
-    FAST_LOG(Operation::Unref, refCountBefore);
+    FAST_LOG(Operation::Unref, reinterpret_cast<size_t>(block), refCountBefore);
     assert(refCountBefore);
     if (refCountBefore == 1) {
         FAST_LOG(Operation::ObjectDestroyed, reinterpret_cast<size_t>(block));
         delete block->data;
         delete block;
     }
-    FAST_LOG(Operation::CASFin, oldPackedPtr);
+    FAST_LOG(Operation::CASFin, oldPackedPtr >> MAGIC_LEN, oldPackedPtr & MAGIC_MASK);
 }
 
 } // namespace LFStructs
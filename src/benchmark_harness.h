@@ -0,0 +1,210 @@
+#pragma once
+
+/* Pieces shared by ThroughputBenchmark and PointerBenchmark: per-thread random
+ * generator, command line options common to both and fixed-duration runner. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "atomic_shared_ptr.h"
+
+namespace Benchmark {
+
+// splitmix64, one instance per thread
+class Random {
+public:
+    explicit Random(uint64_t seed): state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // uniform in [0, 1)
+    double nextDouble() { return (next() >> 11) * 0x1.0p-53; }
+
+private:
+    uint64_t state;
+};
+
+struct Options {
+    Options(double duration, double warmup): duration(duration), warmup(warmup) {}
+
+    double duration;
+    double warmup;
+    std::vector<int> threadCounts;
+    bool pin = false;
+    std::string format = "text";
+};
+
+inline std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> res;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = std::min(list.find(',', begin), list.size());
+        if (end > begin)
+            res.push_back(list.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return res;
+}
+
+/* Parses --name=value arguments: common options are handled here, the rest go
+ * to parseExtra(name, value), which returns false for unknown ones. Without
+ * --threads, thread counts are powers of two up to hardware concurrency. */
+template<typename ParseExtra>
+void parseArguments(int argc, char **argv, Options &options, ParseExtra parseExtra) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string name = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--duration") {
+            options.duration = atof(value.c_str());
+        } else if (name == "--warmup") {
+            options.warmup = atof(value.c_str());
+        } else if (name == "--threads") {
+            for (const std::string &count : split(value))
+                options.threadCounts.push_back(std::max(1, atoi(count.c_str())));
+        } else if (name == "--pin") {
+            options.pin = true;
+        } else if (name == "--format") {
+            options.format = value;
+        } else if (!parseExtra(name, value)) {
+            fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            exit(1);
+        }
+    }
+
+    if (options.threadCounts.empty()) {
+        int hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (int count = 1; count < hardware; count *= 2)
+            options.threadCounts.push_back(count);
+        options.threadCounts.push_back(hardware);
+    }
+}
+
+inline void pinThread(int index) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+
+struct RunResult {
+    double seconds;
+    // operations of every thread counted during measurement
+    std::vector<uint64_t> threadOps;
+
+    uint64_t ops() const {
+        uint64_t res = 0;
+        for (uint64_t value : threadOps)
+            res += value;
+        return res;
+    }
+};
+
+// every hook is optional
+struct RunHooks {
+    // worker thread with its index: before warmup, on first batch of measurement, after its last batch
+    std::function<void(int)> threadStarted;
+    std::function<void(int)> measureStarted;
+    std::function<void(int)> threadFinished;
+    // main thread, right before workers are switched to measurement
+    std::function<void()> beforeMeasure;
+};
+
+/* Runs op(random, threadIndex) on threadCount threads for warmup + duration
+ * seconds. Phase is checked once per batch, so counting costs nothing per
+ * operation: batches started during measurement are counted, including the
+ * one running when it ends. */
+template<typename Op>
+RunResult runThreads(const Options &options, int threadCount, Op op, const RunHooks &hooks = {}) {
+    enum Phase { Starting, Warmup, Measure, Stop };
+    static const int BATCH = 64;
+
+    struct alignas(LFStructs::CACHE_LINE_SIZE) ThreadOps {
+        uint64_t value = 0;
+    };
+
+    std::atomic<int> phase(Starting);
+    std::atomic<int> ready(0);
+    std::vector<ThreadOps> ops(threadCount);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&, i](){
+            if (options.pin)
+                pinThread(i);
+            if (hooks.threadStarted)
+                hooks.threadStarted(i);
+
+            Random random(0x5eed0000ULL + i * 0x1234567ULL);
+            ready.fetch_add(1);
+            while (phase.load(std::memory_order_acquire) == Starting)
+                std::this_thread::yield();
+
+            uint64_t count = 0;
+            bool measuring = false;
+            while (true) {
+                int current = phase.load(std::memory_order_relaxed);
+                if (current == Stop)
+                    break;
+                if (current == Measure && !measuring) {
+                    measuring = true;
+                    if (hooks.measureStarted)
+                        hooks.measureStarted(i);
+                }
+
+                for (int j = 0; j < BATCH; j++)
+                    op(random, i);
+                if (measuring)
+                    count += BATCH;
+            }
+            ops[i].value = count;
+            if (hooks.threadFinished)
+                hooks.threadFinished(i);
+        }));
+
+    while (ready.load() != threadCount)
+        std::this_thread::yield();
+    phase.store(Warmup, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+
+    if (hooks.beforeMeasure)
+        hooks.beforeMeasure();
+    auto start = std::chrono::steady_clock::now();
+    phase.store(Measure, std::memory_order_relaxed);
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    phase.store(Stop, std::memory_order_relaxed);
+    auto end = std::chrono::steady_clock::now();
+
+    for (auto &thread : threads)
+        thread.join();
+
+    RunResult res;
+    res.seconds = std::chrono::duration<double>(end - start).count();
+    for (const ThreadOps &threadOps : ops)
+        res.threadOps.push_back(threadOps.value);
+    return res;
+}
+
+} // namespace Benchmark
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+
+#include "atomic_shared_ptr.h"
+#include "lfhash_map.h"
+
+namespace LFStructs {
+
+/* Cache of at most `capacity` entries with CLOCK eviction.
+ *
+ * Lookups go through LFHashMap and then only set reference bit of entry's
+ * slot, and only if it is not set yet, so a hit takes no lock and there is no
+ * shared LRU list to reorder. It is not free of shared writes though: getFast()
+ * bumps local refcount in map's table root and in the bucket, and returned
+ * value gets a reference. Inserts move clock hand over slot array: referenced
+ * entries get a second chance, first unreferenced one is replaced and removed
+ * from the map.
+ *
+ * Values are handed out as SharedPtr<Value>, so evicted or replaced value
+ * stays valid for readers which still hold it. */
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class ConcurrentCache {
+    struct Entry {
+        Key key;
+        SharedPtr<Value> value;
+    };
+
+    struct Slot {
+        AtomicSharedPtr<Entry> entry;
+        std::atomic<bool> referenced = false;
+    };
+
+    // map value of every cached key
+    struct Location {
+        SharedPtr<Value> value;
+        size_t slot;
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+
+    explicit ConcurrentCache(size_t capacity);
+
+    // empty SharedPtr on miss
+    SharedPtr<Value> get(const Key &key);
+    // inserts or replaces value, evicts some other entry when cache is full
+    void put(Key key, Value value);
+    void erase(const Key &key);
+
+    size_t capacity() const { return slotCount; }
+    // exact when no write is in progress
+    size_t approxSize() const { return map.approxSize(); }
+
+private:
+    // puts entry into some slot, evicting its previous content
+    size_t claimSlot(const SharedPtr<Entry> &entry);
+    // empties slot if it still holds given value
+    void release(size_t slot, const Value *value);
+    // removes key if map still points to given value
+    void removeFromMap(const Key &key, const Value *value);
+
+    size_t slotCount;
+    std::unique_ptr<Slot[]> slots;
+    LFHashMap<Key, Location, Hash> map;
+    // only inserts move it
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> hand;
+};
+
+template<typename Key, typename Value, typename Hash>
+ConcurrentCache<Key, Value, Hash>::ConcurrentCache(size_t capacity)
+    : slotCount(std::max<size_t>(capacity, 1))
+    , slots(new Slot[slotCount])
+    , map(slotCount / 4)
+    , hand(0)
+{}
+
+template<typename Key, typename Value, typename Hash>
+SharedPtr<Value> ConcurrentCache<Key, Value, Hash>::get(const Key &key) {
+    std::optional<Location> location = map.get(key);
+    if (!location)
+        return {};
+
+    // slot may already hold another entry, then it just gets an extra second chance
+    std::atomic<bool> &referenced = slots[location->slot].referenced;
+    if (!referenced.load(std::memory_order_relaxed))
+        referenced.store(true, std::memory_order_relaxed);
+    return std::move(location->value);
+}
+
+template<typename Key, typename Value, typename Hash>
+void ConcurrentCache<Key, Value, Hash>::put(Key key, Value value) {
+    SharedPtr<Value> shared(new Value(std::move(value)));
+    std::optional<Location> previous = map.get(key);
+    size_t slot = claimSlot(SharedPtr<Entry>(new Entry{key, shared}));
+    map.upsert(key, Location{shared, slot});
+
+    // slot may be taken by another insert before upsert above, then its removal from map missed us
+    bool evicted;
+    {
+        FastSharedPtr<Entry> entry = slots[slot].entry.getFast();
+        evicted = entry.get() == nullptr || entry->value.get() != shared.get();
+    }
+    if (evicted)
+        removeFromMap(key, shared.get());
+
+    if (previous)
+        release(previous->slot, previous->value.get());
+}
+
+template<typename Key, typename Value, typename Hash>
+void ConcurrentCache<Key, Value, Hash>::erase(const Key &key) {
+    std::optional<Location> location = map.get(key);
+    if (!location)
+        return;
+
+    removeFromMap(key, location->value.get());
+    release(location->slot, location->value.get());
+}
+
+template<typename Key, typename Value, typename Hash>
+size_t ConcurrentCache<Key, Value, Hash>::claimSlot(const SharedPtr<Entry> &entry) {
+    while (true) {
+        size_t index = hand.fetch_add(1, std::memory_order_relaxed) % slotCount;
+        Slot &slot = slots[index];
+        SharedPtr<Entry> victim = slot.entry.get();
+        if (victim.get() != nullptr && slot.referenced.load(std::memory_order_relaxed)) {
+            slot.referenced.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        if (!slot.entry.compareExchange(victim.get(), SharedPtr<Entry>(entry)))
+            continue;
+        if (victim.get() != nullptr)
+            removeFromMap(victim->key, victim->value.get());
+        return index;
+    }
+}
+
+template<typename Key, typename Value, typename Hash>
+void ConcurrentCache<Key, Value, Hash>::release(size_t slot, const Value *value) {
+    AtomicSharedPtr<Entry> &holder = slots[slot].entry;
+    FastSharedPtr<Entry> entry = holder.getFast();
+    if (entry.get() != nullptr && entry->value.get() == value)
+        holder.compareExchange(entry.get(), SharedPtr<Entry>());
+}
+
+template<typename Key, typename Value, typename Hash>
+void ConcurrentCache<Key, Value, Hash>::removeFromMap(const Key &key, const Value *value) {
+    map.removeIf(key, [value](const Location &location) { return location.value.get() == value; });
+}
+
+} // namespace LFStructs
@@ -1,60 +1,44 @@
 #pragma once
 
+// FAST_LOG(type, address) or FAST_LOG(type, address, value)
 #if not FAST_LOGGING_ENABLED
-#define FAST_LOG(a, b) (static_cast<void>(0))
+#define FAST_LOG(...) (static_cast<void>(0))
 #else
-#define FAST_LOG(a, b) LFStructs::FastLogger::Instance().push(a, b)
+#define FAST_LOG(...) LFStructs::FastLogger::Instance().push(__VA_ARGS__)
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <string>
 #include <thread>
 #include <mutex>
+#include <new>
 #include <vector>
 #include <deque>
 
-namespace LFStructs {
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
-static uint64_t rdtsc() {
-    unsigned int lo,hi;
-    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
-    return ((uint64_t)hi << 32) | lo;
-}
-
-struct Operation {
-    enum Type {
-        Get        = 0,
-        GetRefSucc = 1,
-        GetRefAbrt = 2,
-        CompareAndSwap = 3,
-        CASFin     = 4,
-        CASDestructed = 5,
-        CASAbrt    = 6,
-        Destruct   = 7,
-        Push       = 9,
-        Pop        = 10,
-        GetInCAS   = 12,
-
-        Ref        = 50,
-        Unref      = 51,
-
-        ObjectCreated = 100,
-        ObjectDestroyed = 101
-    } type;
-
-    size_t address;
-    size_t time;
-
-    Operation() = default;
-    inline Operation(Type t, size_t a, size_t time = rdtsc())
-        : type(t)
-        , address(a)
-        , time(time)
-    {}
-};
+#include "fast_logger_format.h"
+
+namespace LFStructs {
 
 class FastLogger {
     struct Storage {
         std::mutex lock;
-        std::vector<std::pair<std::thread::id, std::vector<Operation>*>> containers;
+        std::vector<std::pair<std::thread::id, FastLogger*>> containers;
+    };
+
+    struct Stream {
+        // distinguishes streams which were mapped at the same address
+        uint64_t generation;
+        int fd;
+        size_t mappingSize;
+        TraceFileHeader *header;
+        TraceChunk *chunks;
     };
 
     const int MAX_LOG_COUNT = 2048;
@@ -80,27 +64,114 @@ public:
     // 36 clock cycle is a common number between two calls
     // 100-200 clock cycles to capture something usefull
     // 700-1600 cycle cycles to capture atomic operation under load
-    void push(Operation::Type t, size_t address) {
-        data[currentIndex] = Operation(t, address);
+    void push(uint32_t type, size_t address, size_t value = 0) {
+        data[currentIndex] = Operation(type, address, value);
+        if (stream.load(std::memory_order_relaxed) != nullptr) {
+            // seq_cst pairs with exchange in StopStreaming: either it waits for us or we see no stream
+            writing.store(true);
+            if (Stream *current = stream.load())
+                streamOperation(current, data[currentIndex]);
+            writing.store(false, std::memory_order_release);
+        }
         currentIndex += 1;
         currentIndex %= MAX_LOG_COUNT;
     }
 
+    /* Starts copying every event of every thread into trace file at path, which
+     * can be converted to Chrome trace by TraceConverter. Ring buffers are kept
+     * as before. File never grows over maxBytes: events that don't fit are
+     * only counted. Returns false if file can't be created or stream is active. */
+    static bool StartStreaming(const std::string &path, size_t maxBytes = size_t(256) << 20) {
+        std::lock_guard guard{storage.lock};
+        if (stream.load() != nullptr)
+            return false;
+
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            return false;
+
+        size_t chunkCount = std::max<size_t>(1, (std::max(maxBytes, TRACE_HEADER_SIZE) - TRACE_HEADER_SIZE) / sizeof(TraceChunk));
+        size_t mappingSize = TRACE_HEADER_SIZE + chunkCount * sizeof(TraceChunk);
+        void *mapping = MAP_FAILED;
+        if (ftruncate(fd, mappingSize) == 0)
+            mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+
+        TraceFileHeader *header = new (mapping) TraceFileHeader;
+        memcpy(header->magic, TRACE_FILE_MAGIC, sizeof(header->magic));
+        header->chunkEvents = TRACE_CHUNK_EVENTS;
+        header->eventSize = sizeof(TraceEvent);
+        header->chunkCount = chunkCount;
+        header->usedChunks.store(0);
+        header->droppedEvents.store(0);
+        header->ticksPerNanosecond = ticksPerNanosecond;
+        memcpy(header->userTypeNames, userTypeNames, sizeof(userTypeNames));
+
+        TraceChunk *chunks = reinterpret_cast<TraceChunk*>(static_cast<char*>(mapping) + TRACE_HEADER_SIZE);
+        stream.store(new Stream{++streamGeneration, fd, mappingSize, header, chunks}, std::memory_order_release);
+        return true;
+    }
+
+    /* May be called while other threads log: it waits for events being
+     * written to the file right now, later ones go only to ring buffers. File
+     * is cut to chunks actually used. Without it file is still complete at exit. */
+    static void StopStreaming() {
+        std::lock_guard guard{storage.lock};
+        Stream *current = stream.exchange(nullptr);
+        if (current == nullptr)
+            return;
+
+        // loggers can't unregister while lock is held
+        for (const auto &container : storage.containers)
+            while (container.second->writing.load(std::memory_order_acquire))
+                std::this_thread::yield();
+
+        size_t usedChunks = std::min<size_t>(current->header->usedChunks.load(), current->header->chunkCount);
+        current->header->usedChunks.store(usedChunks);
+        current->header->chunkCount = usedChunks;
+        munmap(current->header, current->mappingSize);
+        if (ftruncate(current->fd, TRACE_HEADER_SIZE + usedChunks * sizeof(TraceChunk)) != 0)
+            perror("FastLogger::StopStreaming");
+        close(current->fd);
+        delete current;
+    }
+
+    static bool Streaming() { return stream.load() != nullptr; }
+
+    // names Operation::User + index type in PrintTrace and trace files
+    static void RegisterEventType(uint32_t type, const char *name) {
+        assert(type >= Operation::User && type < Operation::User + MAX_USER_EVENT_TYPES);
+        std::lock_guard guard{storage.lock};
+        char *slot = userTypeNames[type - Operation::User];
+        strncpy(slot, name, USER_EVENT_NAME_SIZE - 1);
+        if (Stream *current = stream.load())
+            memcpy(current->header->userTypeNames, userTypeNames, sizeof(userTypeNames));
+    }
+
+    static double TicksPerNanosecond() { return ticksPerNanosecond; }
+
+    // event number / nanoseconds since first event / cpu, then type and payload shifted by thread
     static void PrintTrace() {
         std::vector<std::pair<int, Operation>> ops;
         for (int threadNumber = 0; threadNumber < storage.containers.size(); threadNumber++)
-            for (const auto threadLocalOperation : *storage.containers[threadNumber].second)
-                ops.push_back(std::make_pair(threadNumber, threadLocalOperation));
+            for (const auto threadLocalOperation : storage.containers[threadNumber].second->data)
+                if (threadLocalOperation.time != 0)
+                    ops.push_back(std::make_pair(threadNumber, threadLocalOperation));
 
         std::sort(ops.begin(), ops.end(), [](const auto& a, const auto& b){
             return a.second.time < b.second.time;
         });
 
         for (int i = 0; i < ops.size(); i++) {
-            printf("%d / %u:          ", i, int(ops[i].second.time));
+            const Operation &op = ops[i].second;
+            printf("%d / %llu / cpu %u:          ", i,
+                   (unsigned long long)((op.time - ops[0].second.time) / ticksPerNanosecond), op.cpu);
             for (int j = 0; j < ops[i].first * 25; j++)
                 printf(" ");
-            printf("%d %020zx  ", int(ops[i].second.type), ops[i].second.address);
+            printf("%s %020zx %zu  ", TypeName(op.type).c_str(), op.address, op.value);
             printf("\n");
         }
         fflush(stdout);
@@ -109,14 +180,67 @@ public:
 private:
     FastLogger() {
         std::lock_guard guard{storage.lock};
-        storage.containers.push_back({std::this_thread::get_id(), &data});
+        storage.containers.push_back({std::this_thread::get_id(), this});
         data.resize(MAX_LOG_COUNT);
         currentIndex = 0;
+        threadIndex = nextThreadIndex++;
+    }
+
+    static std::string TypeName(uint32_t type) {
+        if (const char *name = Operation::name(type))
+            return name;
+        if (type >= Operation::User && type < Operation::User + MAX_USER_EVENT_TYPES && userTypeNames[type - Operation::User][0])
+            return userTypeNames[type - Operation::User];
+        return std::to_string(type);
+    }
+
+    // TSC ticks against steady_clock over 10ms busy loop
+    static double CalibrateTsc() {
+        uint32_t cpu;
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startTicks = rdtscp(cpu);
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(10)) {}
+        uint64_t endTicks = rdtscp(cpu);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return double(endTicks - startTicks) / std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+    void streamOperation(Stream *current, const Operation &operation) {
+        if (chunkGeneration != current->generation || (chunk != nullptr && chunk->count.load(std::memory_order_relaxed) == TRACE_CHUNK_EVENTS)) {
+            chunkGeneration = current->generation;
+            chunk = nullptr;
+            uint64_t index = current->header->usedChunks.fetch_add(1, std::memory_order_relaxed);
+            if (index < current->header->chunkCount) {
+                chunk = current->chunks + index;
+                chunk->thread = threadIndex;
+            }
+        }
+
+        if (chunk == nullptr) {
+            current->header->droppedEvents.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        uint32_t count = chunk->count.load(std::memory_order_relaxed);
+        chunk->events[count] = TraceEvent{operation.time, operation.address, operation.value, operation.type, operation.cpu};
+        chunk->count.store(count + 1, std::memory_order_release);
     }
 
     static inline Storage storage;
+    static inline std::atomic<Stream*> stream = nullptr;
+    static inline uint32_t nextThreadIndex = 0;
+    static inline uint64_t streamGeneration = 0;
+    static inline char userTypeNames[MAX_USER_EVENT_TYPES][USER_EVENT_NAME_SIZE] = {};
+    // measured once at startup, before any thread logs
+    static inline const double ticksPerNanosecond = CalibrateTsc();
     std::vector<Operation> data;
     int currentIndex;
+    uint32_t threadIndex;
+    // chunk of trace file this thread appends to, valid only for stream of chunkGeneration
+    TraceChunk *chunk = nullptr;
+    uint64_t chunkGeneration = 0;
+    // set while push() may touch current stream
+    std::atomic<bool> writing = false;
 };
 
 } // namespace LFStructs
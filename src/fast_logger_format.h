@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace LFStructs {
+
+/* rdtscp waits for previous instructions, so event is stamped after the
+ * operation it describes, and reports where it ran: Linux keeps cpu number in
+ * low 12 bits of TSC_AUX and numa node above them. */
+inline uint64_t rdtscp(uint32_t &cpu) {
+    unsigned int lo, hi, aux;
+    __asm__ __volatile__ ("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+    cpu = aux & 0xfff;
+    return ((uint64_t)hi << 32) | lo;
+}
+
+struct Operation {
+    enum Type {
+        Get        = 0,
+        GetRefSucc = 1,
+        GetRefAbrt = 2,
+        CompareAndSwap = 3,
+        CASFin     = 4,
+        CASDestructed = 5,
+        CASAbrt    = 6,
+        Destruct   = 7,
+        Push       = 9,
+        Pop        = 10,
+        GetInCAS   = 12,
+
+        Ref        = 50,
+        Unref      = 51,
+
+        ObjectCreated = 100,
+        ObjectDestroyed = 101,
+
+        // types from User on are free for applications, see FastLogger::RegisterEventType
+        User       = 1000
+    };
+
+    uint64_t time;
+    size_t address;
+    // second payload word, e.g. refcount before change
+    size_t value;
+    uint32_t type;
+    uint32_t cpu;
+
+    Operation() = default;
+    inline Operation(uint32_t t, size_t a, size_t v)
+        : time(rdtscp(cpu))
+        , address(a)
+        , value(v)
+        , type(t)
+    {}
+
+    // nullptr for user types and unknown values
+    static const char *name(uint32_t type) {
+        switch (type) {
+        case Get: return "Get";
+        case GetRefSucc: return "GetRefSucc";
+        case GetRefAbrt: return "GetRefAbrt";
+        case CompareAndSwap: return "CompareAndSwap";
+        case CASFin: return "CASFin";
+        case CASDestructed: return "CASDestructed";
+        case CASAbrt: return "CASAbrt";
+        case Destruct: return "Destruct";
+        case Push: return "Push";
+        case Pop: return "Pop";
+        case GetInCAS: return "GetInCAS";
+        case Ref: return "Ref";
+        case Unref: return "Unref";
+        case ObjectCreated: return "ObjectCreated";
+        case ObjectDestroyed: return "ObjectDestroyed";
+        default: return nullptr;
+        }
+    }
+};
+
+/* Trace file written by FastLogger::StartStreaming: header followed by
+ * chunkCount fixed size chunks. Thread takes next free chunk with one atomic
+ * increment and then appends events to it without any synchronization, so a
+ * chunk holds events of one thread in program order. Chunks of one thread are
+ * not adjacent, readers should group them by thread and sort by time.
+ *
+ * File is mapped shared, so everything written before crash is kept by kernel. */
+const char TRACE_FILE_MAGIC[8] = {'L', 'F', 'T', 'R', 'A', 'C', 'E', '2'};
+const uint32_t TRACE_CHUNK_EVENTS = 4096;
+// chunks start right after first page
+const size_t TRACE_HEADER_SIZE = 4096;
+
+const uint32_t MAX_USER_EVENT_TYPES = 64;
+const size_t USER_EVENT_NAME_SIZE = 40;
+
+struct TraceEvent {
+    uint64_t time;
+    uint64_t address;
+    uint64_t value;
+    uint32_t type;
+    uint32_t cpu;
+};
+
+struct TraceChunk {
+    uint32_t thread;
+    // events written so far, updated after every event
+    std::atomic<uint32_t> count;
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+};
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t chunkEvents;
+    uint32_t eventSize;
+    uint64_t chunkCount;
+    // may be larger than chunkCount once file is full
+    std::atomic<uint64_t> usedChunks;
+    // events which didn't fit into file
+    std::atomic<uint64_t> droppedEvents;
+    // TSC frequency measured at startup of writing process
+    double ticksPerNanosecond;
+    // zero terminated names of Operation::User + i types, empty if not registered
+    char userTypeNames[MAX_USER_EVENT_TYPES][USER_EVENT_NAME_SIZE];
+};
+
+static_assert(sizeof(TraceFileHeader) <= TRACE_HEADER_SIZE);
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "trace file counters live in shared memory and must be lock free");
+
+} // namespace LFStructs
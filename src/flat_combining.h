@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+
+namespace LFStructs {
+
+enum class WriteMode {
+    // every writer path-copies and CASes root on its own
+    Direct,
+    // writers publish operations and one of them applies all pending ones as a single version
+    Combining
+};
+
+/* Flat combining publication list.
+ *
+ * Writer claims one of SLOT_COUNT slots, publishes its operation there and then
+ * either becomes combiner (takes combiner flag, applies every pending operation
+ * at once and marks them done) or waits until some other combiner serves it.
+ * Only the combiner does the expensive work, so losers of root CAS don't waste
+ * their path copies anymore. Combining is blocking: a preempted combiner stalls
+ * the writers it serves. */
+template<typename Operation>
+class FlatCombiner {
+public:
+    static const int SLOT_COUNT = 64;
+
+    FlatCombiner() = default;
+    FlatCombiner(const FlatCombiner &other) = delete;
+    FlatCombiner& operator=(const FlatCombiner &other) = delete;
+
+    // returns false if all slots are busy, operation should be applied directly then
+    bool execute(Operation op, const std::function<void(std::vector<Operation>&)> &apply);
+
+private:
+    enum SlotState {
+        Free,
+        Claimed,
+        Pending,
+        Done
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<int> state = Free;
+        std::optional<Operation> op;
+    };
+
+    void combine(const std::function<void(std::vector<Operation>&)> &apply);
+
+    Slot slots[SLOT_COUNT];
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> combinerActive = false;
+};
+
+template<typename Operation>
+bool FlatCombiner<Operation>::execute(Operation op, const std::function<void(std::vector<Operation>&)> &apply) {
+    size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+    Slot *slot = nullptr;
+    for (int i = 0; i < SLOT_COUNT && slot == nullptr; i++) {
+        Slot &candidate = slots[(start + i) % SLOT_COUNT];
+        int expected = Free;
+        if (candidate.state.load(std::memory_order_relaxed) == Free &&
+                candidate.state.compare_exchange_strong(expected, Claimed, std::memory_order_acquire))
+            slot = &candidate;
+    }
+    if (slot == nullptr)
+        return false;
+
+    slot->op = std::move(op);
+    slot->state.store(Pending, std::memory_order_release);
+
+    while (slot->state.load(std::memory_order_acquire) != Done) {
+        if (!combinerActive.load(std::memory_order_relaxed) && !combinerActive.exchange(true, std::memory_order_acquire)) {
+            combine(apply);
+            combinerActive.store(false, std::memory_order_release);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    slot->op.reset();
+    slot->state.store(Free, std::memory_order_release);
+    return true;
+}
+
+template<typename Operation>
+void FlatCombiner<Operation>::combine(const std::function<void(std::vector<Operation>&)> &apply) {
+    thread_local std::vector<Operation> batch;
+    thread_local std::vector<Slot*> served;
+    batch.clear();
+    served.clear();
+
+    for (Slot &slot : slots) {
+        if (slot.state.load(std::memory_order_acquire) == Pending) {
+            batch.push_back(*slot.op);
+            served.push_back(&slot);
+        }
+    }
+    if (batch.empty())
+        return;
+
+    apply(batch);
+    for (Slot *slot : served)
+        slot->state.store(Done, std::memory_order_release);
+}
+
+} // namespace LFStructs
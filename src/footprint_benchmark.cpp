@@ -0,0 +1,138 @@
+/* Memory footprint and throughput of containers holding many small elements.
+ *
+ * Usage: FootprintBenchmark [elementCount = 10000000] [threadCount = hardware concurrency]
+ *
+ * Footprint is heap bytes in use per element after filling, as reported by
+ * malloc. Compare builds with -DLFSTRUCTS_PADDING=0/64/128 to see the cost of
+ * padding ControlBlock and AtomicSharedPtr. */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "lfqueue.h"
+#include "lfstack.h"
+#include "lfmap.h"
+#include "lfmap_avl.h"
+#include "lfbtree_map.h"
+#include "lfskiplist_map.h"
+#include "lfhash_map.h"
+
+namespace {
+
+size_t heapInUse() {
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    // int fields wrap around past 2 GiB
+    struct mallinfo info = mallinfo();
+#endif
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const char *name, size_t elementCount, size_t heapBefore, size_t heapAfter,
+            double fillSeconds, const char *secondPhase, double secondSeconds, size_t secondOps) {
+    printf("%-12s %10.1f B/elem %10.2f Mop/s fill %10.2f Mop/s %s\n",
+           name,
+           double(heapAfter - heapBefore) / elementCount,
+           elementCount / fillSeconds / 1e6,
+           secondOps / secondSeconds / 1e6,
+           secondPhase);
+}
+
+template<typename Map>
+void benchmarkMap(const char *name, const std::vector<int> &keys, int threadCount) {
+    size_t heapBefore = heapInUse();
+    std::unique_ptr<Map> map(new Map());
+
+    auto start = std::chrono::steady_clock::now();
+    for (int key : keys)
+        map->upsert(key, key);
+    double fillSeconds = secondsSince(start);
+    size_t heapAfter = heapInUse();
+
+    start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&map, &keys, i, threadCount](){
+            size_t found = 0;
+            for (size_t j = i; j < keys.size(); j += threadCount)
+                found += bool(map->get(keys[keys.size() - j - 1]));
+            if (found != (keys.size() + threadCount - i - 1) / threadCount)
+                abort();
+        }));
+    for (auto &thread : threads)
+        thread.join();
+    double readSeconds = secondsSince(start);
+
+    report(name, keys.size(), heapBefore, heapAfter, fillSeconds, "get", readSeconds, keys.size());
+}
+
+template<typename Container>
+void benchmarkSequence(const char *name, size_t elementCount) {
+    size_t heapBefore = heapInUse();
+    std::unique_ptr<Container> container(new Container());
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < elementCount; i++)
+        container->push(int(i));
+    double fillSeconds = secondsSince(start);
+    size_t heapAfter = heapInUse();
+
+    start = std::chrono::steady_clock::now();
+    size_t popped = 0;
+    while (container->pop())
+        popped++;
+    double popSeconds = secondsSince(start);
+    if (popped != elementCount)
+        abort();
+
+    report(name, elementCount, heapBefore, heapAfter, fillSeconds, "pop", popSeconds, elementCount);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t elementCount = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 10'000'000;
+    int threadCount = argc > 2 ? atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+
+    printf("LFSTRUCTS_PADDING=%d sizeof(ControlBlock)=%zu sizeof(AtomicSharedPtr)=%zu sizeof(FastSharedPtr)=%zu\n",
+           LFSTRUCTS_PADDING,
+           sizeof(LFStructs::ControlBlock<int>),
+           sizeof(LFStructs::AtomicSharedPtr<int>),
+           sizeof(LFStructs::FastSharedPtr<int>));
+    printf("%zu elements, %d reader threads\n\n", elementCount, threadCount);
+
+    benchmarkSequence<LFStructs::LFQueue<int>>("LFQueue", elementCount);
+    benchmarkSequence<LFStructs::LFStack<int>>("LFStack", elementCount);
+
+    std::vector<int> keys(elementCount);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+    benchmarkMap<LFStructs::LFMap<int, int>>("LFMap", keys, threadCount);
+    benchmarkMap<LFStructs::LFMapAvl<int, int>>("LFMapAvl", keys, threadCount);
+    benchmarkMap<LFStructs::LFBTreeMap<int, int>>("LFBTreeMap", keys, threadCount);
+    benchmarkMap<LFStructs::LFSkipListMap<int, int>>("LFSkipListMap", keys, threadCount);
+    benchmarkMap<LFStructs::LFHashMap<int, int>>("LFHashMap", keys, threadCount);
+
+    return 0;
+}
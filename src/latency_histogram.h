@@ -0,0 +1,211 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#ifndef LATENCY_HISTOGRAMS_ENABLED
+#define LATENCY_HISTOGRAMS_ENABLED 0
+#endif
+
+#if not LATENCY_HISTOGRAMS_ENABLED
+#define LATENCY_SCOPE(op) (static_cast<void>(0))
+#else
+#define LATENCY_SCOPE_CONCAT_IMPL(a, b) a##b
+#define LATENCY_SCOPE_CONCAT(a, b) LATENCY_SCOPE_CONCAT_IMPL(a, b)
+#define LATENCY_SCOPE(op) LFStructs::LatencyScope LATENCY_SCOPE_CONCAT(latencyScope, __LINE__)(op)
+#endif
+
+namespace LFStructs {
+
+enum class LatencyOp {
+    Push,
+    Pop,
+    Get,
+    Upsert,
+    Remove,
+    Count
+};
+
+inline const char *latencyOpName(LatencyOp op) {
+    static const char *names[] = {"push", "pop", "get", "upsert", "remove"};
+    return names[int(op)];
+}
+
+/* Log-linear histogram of nanosecond values in the spirit of HdrHistogram:
+ * values below 2^SUB_BITS get exact buckets, every next power of two range is
+ * split into 2^SUB_BITS equal buckets, so relative error is below 1/32.
+ *
+ * record() may be called by one owner thread only, any thread may copy it
+ * concurrently and sees a slightly stale but consistent enough picture. */
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 5;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    // values are clamped to 2^MAX_BITS ns, which is about 18 minutes
+    static const int MAX_BITS = 40;
+    static const int BUCKET_COUNT = (MAX_BITS - SUB_BITS + 2) * SUB_COUNT;
+
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram &other) { add(other); }
+    LatencyHistogram& operator=(const LatencyHistogram &other) {
+        if (this != &other) {
+            clear();
+            add(other);
+        }
+        return *this;
+    }
+
+    void record(uint64_t nanoseconds) {
+        auto &bucket = counts[bucketIndex(nanoseconds)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void add(const LatencyHistogram &other) {
+        for (int i = 0; i < BUCKET_COUNT; i++)
+            counts[i].store(counts[i].load(std::memory_order_relaxed) + other.counts[i].load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+    }
+
+    // removes values of earlier copy of the same histogram, e.g. recorded during warmup
+    void subtract(const LatencyHistogram &earlier) {
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            uint64_t current = counts[i].load(std::memory_order_relaxed);
+            uint64_t removed = std::min(current, earlier.counts[i].load(std::memory_order_relaxed));
+            counts[i].store(current - removed, std::memory_order_relaxed);
+        }
+    }
+
+    void clear() {
+        for (auto &count : counts)
+            count.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        uint64_t res = 0;
+        for (const auto &count : counts)
+            res += count.load(std::memory_order_relaxed);
+        return res;
+    }
+
+    // highest value equivalent to percentile bucket, percentile is in [0, 100]
+    uint64_t valueAtPercentile(double percentile) const {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+
+        uint64_t rank = std::max<uint64_t>(1, uint64_t(percentile / 100 * total + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_COUNT; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= std::min(rank, total))
+                return bucketHighest(i);
+        }
+
+        return bucketHighest(BUCKET_COUNT - 1);
+    }
+
+    uint64_t max() const {
+        for (int i = BUCKET_COUNT - 1; i >= 0; i--)
+            if (counts[i].load(std::memory_order_relaxed))
+                return bucketHighest(i);
+
+        return 0;
+    }
+
+private:
+    static int bucketIndex(uint64_t value) {
+        value = std::min(value, (uint64_t(1) << MAX_BITS) - 1);
+        if (value < SUB_COUNT)
+            return int(value);
+
+        int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + int((value >> shift) - SUB_COUNT);
+    }
+
+    static uint64_t bucketHighest(int index) {
+        if (index < SUB_COUNT)
+            return index;
+
+        int shift = index / SUB_COUNT - 1;
+        uint64_t lowest = uint64_t(SUB_COUNT + index % SUB_COUNT) << shift;
+        return lowest + (uint64_t(1) << shift) - 1;
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts = {};
+};
+
+/* Every thread records into its own histograms, which are registered here.
+ * Histograms of finished threads are folded into `retired`, so merged result
+ * still contains them after join. */
+class LatencyRegistry {
+    struct ThreadHistograms {
+        LatencyHistogram histograms[int(LatencyOp::Count)];
+
+        ThreadHistograms() {
+            std::lock_guard guard{instance().lock};
+            instance().threads.push_back(this);
+        }
+
+        ~ThreadHistograms() {
+            LatencyRegistry &registry = instance();
+            std::lock_guard guard{registry.lock};
+            for (int i = 0; i < int(LatencyOp::Count); i++)
+                registry.retired[i].add(histograms[i]);
+            registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+        }
+    };
+
+public:
+    static LatencyRegistry &instance() {
+        static LatencyRegistry registry;
+        return registry;
+    }
+
+    static LatencyHistogram &threadHistogram(LatencyOp op) {
+        thread_local ThreadHistograms histograms;
+        return histograms.histograms[int(op)];
+    }
+
+    LatencyHistogram merged(LatencyOp op) {
+        std::lock_guard guard{lock};
+        LatencyHistogram res = retired[int(op)];
+        for (const ThreadHistograms *thread : threads)
+            res.add(thread->histograms[int(op)]);
+
+        return res;
+    }
+
+private:
+    std::mutex lock;
+    std::vector<ThreadHistograms*> threads;
+    LatencyHistogram retired[int(LatencyOp::Count)];
+};
+
+// merged latency of op over all threads that ever recorded it
+inline LatencyHistogram latencyHistogram(LatencyOp op) {
+    return LatencyRegistry::instance().merged(op);
+}
+
+class LatencyScope {
+public:
+    explicit LatencyScope(LatencyOp op)
+        : op(op)
+        , start(std::chrono::steady_clock::now())
+    {}
+
+    ~LatencyScope() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        LatencyRegistry::threadHistogram(op).record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+private:
+    LatencyOp op;
+    std::chrono::steady_clock::time_point start;
+};
+
+} // namespace LFStructs
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <algorithm>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include "atomic_shared_ptr.h"
+
+namespace LFStructs {
+
+/* Persistent copy-on-write B+tree behind one AtomicSharedPtr root.
+ *
+ * Same idea as LFMap/LFMapAvl (copy the path, CAS the root), but every node
+ * keeps up to Fanout sorted keys in one array. Lookup scans O(log_Fanout n)
+ * key arrays with branchless counting loops instead of chasing 2 * log2(n)
+ * binary tree nodes, and update allocates one node per level.
+ *
+ * Inner node keys[i] is the smallest key that may be found in children[i]
+ * (keys[0] is kept equal to parent separator), leaf keeps key/value pairs.
+ * Leaves and inner nodes are separate types, so a leaf carries no child
+ * pointers and an inner node no values. */
+template<typename Key, typename Value, int Fanout = 32>
+class LFBTreeMap {
+    static_assert(Fanout >= 4);
+
+    // common part of Leaf and Inner, which is owned by SharedPtr<Node>
+    struct Node {
+        explicit Node(bool leaf): leaf(leaf) {}
+        virtual ~Node() = default;
+
+        int count = 0;
+        const bool leaf;
+        Key keys[Fanout];
+    };
+
+    // values are constructed only in [0, count), so Value needs no default constructor
+    struct Leaf : Node {
+        Leaf(): Node(true) {}
+        ~Leaf() override {
+            for (int i = 0; i < this->count; i++)
+                values()[i].~Value();
+        }
+
+        Value* values() { return reinterpret_cast<Value*>(storage); }
+        const Value* values() const { return reinterpret_cast<const Value*>(storage); }
+
+        alignas(Value) unsigned char storage[sizeof(Value) * Fanout];
+    };
+
+    struct Inner : Node {
+        Inner(): Node(false) {}
+
+        SharedPtr<Node> children[Fanout];
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+
+    LFBTreeMap() = default;
+
+    void upsert(Key key, Value value);
+    std::optional<Value> get(Key key);
+    void remove(Key key);
+
+    // exact when no write is in progress
+    size_t approxSize() const { return std::max(counter.load(), 0LL); }
+
+private:
+    static const int MIN_COUNT = Fanout / 4;
+
+    static Leaf* asLeaf(Node *node) { return static_cast<Leaf*>(node); }
+    static const Leaf* asLeaf(const Node *node) { return static_cast<const Leaf*>(node); }
+    static Inner* asInner(Node *node) { return static_cast<Inner*>(node); }
+    static const Inner* asInner(const Node *node) { return static_cast<const Inner*>(node); }
+
+    // number of keys[1..count) which are <= key, that is index of child for key
+    static int childIndex(const Node *node, const Key &key);
+    // number of keys < key
+    static int lowerBound(const Node *node, const Key &key);
+
+    static SharedPtr<Node> newNode(bool leaf);
+    static SharedPtr<Node> clone(const Node *node);
+    // copies entry `from` of src to the end of dst
+    static void appendEntry(Node *dst, const Node *src, int from);
+    // drops entries from count on
+    static void truncate(Node *node, int count);
+    static void insertAt(const SharedPtr<Node> &node, int pos, const Key &key,
+                         const Value *value, const SharedPtr<Node> *child, SharedPtr<Node> &sibling);
+    static void removeAt(Node *node, int pos);
+    // entries [from, to) of left and right concatenated, separator is lower bound of right
+    static SharedPtr<Node> concatRange(const Node *left, const Node *right, const Key &separator, int from, int to);
+    static void rebalance(Inner *node, int pos);
+
+    static SharedPtr<Node> upsert(const Node *node, const Key &key, const Value &value, SharedPtr<Node> &sibling, bool &inserted);
+    static SharedPtr<Node> remove(const SharedPtr<Node> &node, const Key &key);
+
+    alignas(CACHE_LINE_SIZE) AtomicSharedPtr<Node> root;
+    StripedCounter counter;
+};
+
+template<typename Key, typename Value, int Fanout>
+int LFBTreeMap<Key, Value, Fanout>::childIndex(const Node *node, const Key &key) {
+    int index = 0;
+    for (int i = 1; i < node->count; i++)
+        index += !(key < node->keys[i]);
+
+    return index;
+}
+
+template<typename Key, typename Value, int Fanout>
+int LFBTreeMap<Key, Value, Fanout>::lowerBound(const Node *node, const Key &key) {
+    int index = 0;
+    for (int i = 0; i < node->count; i++)
+        index += node->keys[i] < key;
+
+    return index;
+}
+
+template<typename Key, typename Value, int Fanout>
+std::optional<Value> LFBTreeMap<Key, Value, Fanout>::get(Key key) {
+    LATENCY_SCOPE(LatencyOp::Get);
+    FastSharedPtr<Node> rootCopy = root.getFast();
+    const Node *node = rootCopy.get();
+    if (node == nullptr)
+        return {};
+
+    while (!node->leaf)
+        node = asInner(node)->children[childIndex(node, key)].get();
+
+    int pos = lowerBound(node, key);
+    if (pos < node->count && !(key < node->keys[pos]))
+        return asLeaf(node)->values()[pos];
+
+    return {};
+}
+
+template<typename Key, typename Value, int Fanout>
+void LFBTreeMap<Key, Value, Fanout>::upsert(Key key, Value value) {
+    LATENCY_SCOPE(LatencyOp::Upsert);
+    while (true) {
+        SharedPtr<Node> rootCopy = root.get();
+        SharedPtr<Node> newRoot;
+        bool inserted = true;
+        if (rootCopy.get() == nullptr) {
+            newRoot = newNode(true);
+            newRoot->keys[0] = key;
+            new (asLeaf(newRoot.get())->values()) Value(value);
+            newRoot->count = 1;
+        } else {
+            SharedPtr<Node> sibling;
+            newRoot = upsert(rootCopy.get(), key, value, sibling, inserted);
+            if (sibling.get() != nullptr) {
+                SharedPtr<Node> top = newNode(false);
+                top->count = 2;
+                top->keys[0] = newRoot->keys[0];
+                top->keys[1] = sibling->keys[0];
+                asInner(top.get())->children[0] = std::move(newRoot);
+                asInner(top.get())->children[1] = std::move(sibling);
+                newRoot = std::move(top);
+            }
+        }
+
+        if (root.compareExchange(rootCopy.get(), std::move(newRoot))) {
+            if (inserted)
+                counter.add(1);
+            return;
+        }
+    }
+}
+
+template<typename Key, typename Value, int Fanout>
+void LFBTreeMap<Key, Value, Fanout>::remove(Key key) {
+    LATENCY_SCOPE(LatencyOp::Remove);
+    while (true) {
+        SharedPtr<Node> rootCopy = root.get();
+        if (rootCopy.get() == nullptr)
+            return;
+
+        SharedPtr<Node> newRoot = remove(rootCopy, key);
+        if (newRoot.get() == rootCopy.get())
+            return;
+
+        while (!newRoot->leaf && newRoot->count == 1)
+            newRoot = asInner(newRoot.get())->children[0].copy();
+        if (newRoot->leaf && newRoot->count == 0)
+            newRoot = SharedPtr<Node>();
+
+        if (root.compareExchange(rootCopy.get(), std::move(newRoot))) {
+            counter.add(-1);
+            return;
+        }
+    }
+}
+
+template<typename Key, typename Value, int Fanout>
+SharedPtr<typename LFBTreeMap<Key, Value, Fanout>::Node> LFBTreeMap<Key, Value, Fanout>::newNode(bool leaf) {
+    if (leaf)
+        return SharedPtr<Node>(new Leaf());
+    return SharedPtr<Node>(new Inner());
+}
+
+template<typename Key, typename Value, int Fanout>
+SharedPtr<typename LFBTreeMap<Key, Value, Fanout>::Node> LFBTreeMap<Key, Value, Fanout>::clone(const Node *node) {
+    SharedPtr<Node> res = newNode(node->leaf);
+    for (int i = 0; i < node->count; i++)
+        appendEntry(res.get(), node, i);
+
+    return res;
+}
+
+template<typename Key, typename Value, int Fanout>
+void LFBTreeMap<Key, Value, Fanout>::appendEntry(Node *dst, const Node *src, int from) {
+    dst->keys[dst->count] = src->keys[from];
+    if (src->leaf)
+        new (asLeaf(dst)->values() + dst->count) Value(asLeaf(src)->values()[from]);
+    else
+        asInner(dst)->children[dst->count] = asInner(src)->children[from];
+    dst->count++;
+}
+
+template<typename Key, typename Value, int Fanout>
+void LFBTreeMap<Key, Value, Fanout>::truncate(Node *node, int count) {
+    for (int i = count; i < node->count; i++) {
+        if (node->leaf)
+            asLeaf(node)->values()[i].~Value();
+        else
+            asInner(node)->children[i] = SharedPtr<Node>();
+    }
+    node->count = count;
+}
+
+template<typename Key, typename Value, int Fanout>
+void LFBTreeMap<Key, Value, Fanout>::insertAt(const SharedPtr<Node> &node, int pos, const Key &key,
+                                              const Value *value, const SharedPtr<Node> *child, SharedPtr<Node> &sibling) {
+    Node *target = node.get();
+    if (node->count == Fanout) {
+        // node is not published yet, so upper half can be moved out in place
+        int half = Fanout / 2;
+        sibling = newNode(node->leaf);
+        for (int i = half; i < Fanout; i++)
+            appendEntry(sibling.get(), node.get(), i);
+        truncate(node.get(), half);
+
+        if (pos > half) {
+            target = sibling.get();
+            pos -= half;
+        }
+    }
+
+    int count = target->count;
+    for (int i = count; i > pos; i--)
+        target->keys[i] = target->keys[i - 1];
+    target->keys[pos] = key;
+    if (target->leaf) {
+        Value *values = asLeaf(target)->values();
+        if (pos == count) {
+            new (values + pos) Value(*value);
+        } else {
+            // slot past the end is raw memory, it is constructed, the rest is assigned
+            new (values + count) Value(std::move(values[count - 1]));
+            for (int i = count - 1; i > pos; i--)
+                values[i] = std::move(values[i - 1]);
+            values[pos] = *value;
+        }
+    } else {
+        SharedPtr<Node> *children = asInner(target)->children;
+        for (int i = count; i > pos; i--)
+            children[i] = std::move(children[i - 1]);
+        children[pos] = *child;
+    }
+    target->count++;
+}
+
+template<typename Key, typename Value, int Fanout>
+void LFBTreeMap<Key, Value, Fanout>::removeAt(Node *node, int pos) {
+    for (int i = pos; i + 1 < node->count; i++) {
+        node->keys[i] = node->keys[i + 1];
+        if (node->leaf)
+            asLeaf(node)->values()[i] = std::move(asLeaf(node)->values()[i + 1]);
+        else
+            asInner(node)->children[i] = std::move(asInner(node)->children[i + 1]);
+    }
+    truncate(node, node->count - 1);
+}
+
+template<typename Key, typename Value, int Fanout>
+SharedPtr<typename LFBTreeMap<Key, Value, Fanout>::Node>
+LFBTreeMap<Key, Value, Fanout>::concatRange(const Node *left, const Node *right, const Key &separator, int from, int to) {
+    SharedPtr<Node> res = newNode(left->leaf);
+    for (int i = from; i < to; i++) {
+        if (i < left->count) {
+            appendEntry(res.get(), left, i);
+        } else {
+            appendEntry(res.get(), right, i - left->count);
+            if (i == left->count && !left->leaf)
+                res->keys[i - from] = separator;
+        }
+    }
+
+    return res;
+}
+
+// merges underfull children[pos] with neighbour or moves part of neighbour entries to it
+template<typename Key, typename Value, int Fanout>
+void LFBTreeMap<Key, Value, Fanout>::rebalance(Inner *node, int pos) {
+    int l = pos > 0 ? pos - 1 : pos;
+    int r = l + 1;
+    const Node *left = node->children[l].get();
+    const Node *right = node->children[r].get();
+    int total = left->count + right->count;
+    if (total <= Fanout) {
+        node->children[l] = concatRange(left, right, node->keys[r], 0, total);
+        removeAt(node, r);
+    } else {
+        SharedPtr<Node> newLeft = concatRange(left, right, node->keys[r], 0, total / 2);
+        SharedPtr<Node> newRight = concatRange(left, right, node->keys[r], total / 2, total);
+        node->keys[r] = newRight->keys[0];
+        node->children[l] = std::move(newLeft);
+        node->children[r] = std::move(newRight);
+    }
+}
+
+template<typename Key, typename Value, int Fanout>
+SharedPtr<typename LFBTreeMap<Key, Value, Fanout>::Node>
+LFBTreeMap<Key, Value, Fanout>::upsert(const Node *node, const Key &key, const Value &value, SharedPtr<Node> &sibling, bool &inserted) {
+    if (node->leaf) {
+        int pos = lowerBound(node, key);
+        SharedPtr<Node> res = clone(node);
+        inserted = pos == node->count || key < node->keys[pos];
+        if (!inserted)
+            asLeaf(res.get())->values()[pos] = value;
+        else
+            insertAt(res, pos, key, &value, nullptr, sibling);
+        return res;
+    }
+
+    int pos = childIndex(node, key);
+    SharedPtr<Node> childSibling;
+    SharedPtr<Node> child = upsert(asInner(node)->children[pos].get(), key, value, childSibling, inserted);
+
+    SharedPtr<Node> res = clone(node);
+    asInner(res.get())->children[pos] = std::move(child);
+    if (key < res->keys[pos])
+        res->keys[pos] = key; // only possible for leftmost path
+    if (childSibling.get() != nullptr)
+        insertAt(res, pos + 1, childSibling->keys[0], nullptr, &childSibling, sibling);
+
+    return res;
+}
+
+template<typename Key, typename Value, int Fanout>
+SharedPtr<typename LFBTreeMap<Key, Value, Fanout>::Node>
+LFBTreeMap<Key, Value, Fanout>::remove(const SharedPtr<Node> &node, const Key &key) {
+    if (node->leaf) {
+        int pos = lowerBound(node.get(), key);
+        if (pos == node->count || key < node->keys[pos])
+            return node;
+
+        SharedPtr<Node> res = clone(node.get());
+        removeAt(res.get(), pos);
+        return res;
+    }
+
+    int pos = childIndex(node.get(), key);
+    const SharedPtr<Node> &oldChild = asInner(node.get())->children[pos];
+    SharedPtr<Node> child = remove(oldChild, key);
+    if (child.get() == oldChild.get())
+        return node;
+
+    SharedPtr<Node> res = clone(node.get());
+    Inner *inner = asInner(res.get());
+    inner->children[pos] = std::move(child);
+    if (inner->children[pos]->count < MIN_COUNT && inner->count > 1)
+        rebalance(inner, pos);
+
+    return res;
+}
+
+} // namespace LFStructs
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+
+namespace LFStructs {
+
+/* Hash map with LFMap API.
+ *
+ * Every bucket is an immutable array of entries behind its own AtomicSharedPtr,
+ * so writers CAS only the bucket they touch and writers to different buckets
+ * never conflict. Order of keys is not kept.
+ *
+ * Table grows incrementally. When some bucket gets too long and average load
+ * of buckets is high too, a table of double size is attached as `next`. After
+ * that every writer migrates the bucket it needs (plus a few more) before
+ * writing to the new table: old bucket is replaced by frozen copy, then both
+ * buckets of the new table are created from it. Readers never help, they
+ * follow frozen buckets to the new table, or read frozen contents if new
+ * bucket is not created yet. Once every old bucket is migrated, root switches
+ * to the new table.
+ *
+ * Long bucket in a lightly loaded table means keys collide in low hash bits,
+ * which doubling wouldn't fix, so such bucket just stays a longer chain. */
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LFHashMap {
+    struct Entry {
+        size_t hash;
+        Key key;
+        Value data;
+    };
+
+    struct Bucket {
+        std::vector<Entry> entries;
+        bool frozen = false;
+    };
+
+    struct Table {
+        explicit Table(size_t capacity)
+            : capacity(capacity)
+            , buckets(new AtomicSharedPtr<Bucket>[capacity])
+            , migrated(0)
+            , migrationCursor(0)
+        {}
+
+        size_t capacity;
+        // nullptr bucket - not migrated from previous table yet
+        std::unique_ptr<AtomicSharedPtr<Bucket>[]> buckets;
+        AtomicSharedPtr<Table> next;
+        std::atomic<size_t> migrated;
+        std::atomic<size_t> migrationCursor;
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using Condition = std::function<bool(const Value&)>;
+
+    explicit LFHashMap(size_t initialCapacity = 16);
+
+    void upsert(Key key, Value value);
+    std::optional<Value> get(Key key);
+    void remove(Key key);
+    // removes key only if condition holds for its current value, returns whether it did
+    bool removeIf(Key key, const Condition &condition);
+
+    // exact when no write is in progress
+    size_t approxSize() const { return std::max(counter.load(), 0LL); }
+
+private:
+    static const size_t MAX_BUCKET_SIZE = 8;
+    // average entries per bucket above which long bucket makes table grow
+    static const size_t MAX_LOAD_FACTOR = 2;
+    static const int MIGRATION_STEP = 2;
+
+    static std::optional<Value> find(const Bucket *bucket, size_t hash, const Key &key);
+
+    // returns nullptr if nothing changed, condition (if any) is checked against existing value
+    static SharedPtr<Bucket> modify(const Bucket *bucket, size_t hash, const Key &key, const Value *value,
+                                    const Condition *condition);
+
+    // returns whether map changed
+    bool write(const Key &key, const Value *value, const Condition *condition = nullptr);
+    void grow(const SharedPtr<Table> &current);
+    void migrate(const SharedPtr<Table> &current, size_t index);
+
+    alignas(CACHE_LINE_SIZE) AtomicSharedPtr<Table> table;
+    Hash hasher;
+    StripedCounter counter;
+};
+
+template<typename Key, typename Value, typename Hash>
+LFHashMap<Key, Value, Hash>::LFHashMap(size_t initialCapacity) {
+    size_t capacity = 1;
+    while (capacity < initialCapacity)
+        capacity *= 2;
+
+    SharedPtr<Table> initial(new Table(capacity));
+    for (size_t i = 0; i < capacity; i++)
+        initial->buckets[i].store(new Bucket());
+    table.store(std::move(initial));
+}
+
+template<typename Key, typename Value, typename Hash>
+std::optional<Value> LFHashMap<Key, Value, Hash>::find(const Bucket *bucket, size_t hash, const Key &key) {
+    for (const Entry &entry : bucket->entries)
+        if (entry.hash == hash && entry.key == key)
+            return entry.data;
+
+    return {};
+}
+
+template<typename Key, typename Value, typename Hash>
+SharedPtr<typename LFHashMap<Key, Value, Hash>::Bucket>
+LFHashMap<Key, Value, Hash>::modify(const Bucket *bucket, size_t hash, const Key &key, const Value *value,
+                                    const Condition *condition) {
+    if (condition != nullptr) {
+        auto found = std::find_if(bucket->entries.begin(), bucket->entries.end(),
+                                  [&](const Entry &entry) { return entry.hash == hash && entry.key == key; });
+        if (found == bucket->entries.end() || !(*condition)(found->data))
+            return {};
+    }
+
+    SharedPtr<Bucket> res(new Bucket());
+    res->entries.reserve(bucket->entries.size() + 1);
+    bool found = false;
+    for (const Entry &entry : bucket->entries) {
+        if (entry.hash == hash && entry.key == key) {
+            found = true;
+            if (value != nullptr)
+                res->entries.push_back({hash, key, *value});
+        } else {
+            res->entries.push_back(entry);
+        }
+    }
+
+    if (!found) {
+        if (value == nullptr)
+            return {};
+        res->entries.push_back({hash, key, *value});
+    }
+
+    return res;
+}
+
+template<typename Key, typename Value, typename Hash>
+std::optional<Value> LFHashMap<Key, Value, Hash>::get(Key key) {
+    LATENCY_SCOPE(LatencyOp::Get);
+    size_t hash = hasher(key);
+    // root is pinned by local refcount only, tables after it are rare and get a full reference
+    FastSharedPtr<Table> root = table.getFast();
+    SharedPtr<Table> pinned;
+    Table *current = root.get();
+    while (true) {
+        SharedPtr<Table> next;
+        {
+            FastSharedPtr<Bucket> bucket = current->buckets[hash & (current->capacity - 1)].getFast();
+            if (!bucket->frozen)
+                return find(bucket.get(), hash, key);
+
+            // bucket moved to next table, but new copy may be not created yet
+            next = current->next.get();
+            if (next->buckets[hash & (next->capacity - 1)].getFast().get() == nullptr)
+                return find(bucket.get(), hash, key);
+        }
+
+        // FastSharedPtr above should be released before its table
+        pinned = std::move(next);
+        current = pinned.get();
+    }
+}
+
+template<typename Key, typename Value, typename Hash>
+void LFHashMap<Key, Value, Hash>::upsert(Key key, Value value) {
+    LATENCY_SCOPE(LatencyOp::Upsert);
+    write(key, &value);
+}
+
+template<typename Key, typename Value, typename Hash>
+void LFHashMap<Key, Value, Hash>::remove(Key key) {
+    LATENCY_SCOPE(LatencyOp::Remove);
+    write(key, nullptr);
+}
+
+template<typename Key, typename Value, typename Hash>
+bool LFHashMap<Key, Value, Hash>::removeIf(Key key, const Condition &condition) {
+    LATENCY_SCOPE(LatencyOp::Remove);
+    return write(key, nullptr, &condition);
+}
+
+template<typename Key, typename Value, typename Hash>
+bool LFHashMap<Key, Value, Hash>::write(const Key &key, const Value *value, const Condition *condition) {
+    size_t hash = hasher(key);
+    SharedPtr<Table> current = table.get();
+    while (true) {
+        size_t index = hash & (current->capacity - 1);
+        if (current->next.getFast().get() != nullptr) {
+            migrate(current, index);
+            for (int i = 0; i < MIGRATION_STEP; i++) {
+                size_t extra = current->migrationCursor.fetch_add(1);
+                if (extra >= current->capacity)
+                    break;
+                migrate(current, extra);
+            }
+
+            current = current->next.get();
+            continue;
+        }
+
+        AtomicSharedPtr<Bucket> &slot = current->buckets[index];
+        SharedPtr<Bucket> bucket = slot.get();
+        if (bucket->frozen)
+            continue; // table started migration, retry through next
+
+        SharedPtr<Bucket> newBucket = modify(bucket.get(), hash, key, value, condition);
+        if (newBucket.get() == nullptr)
+            return false;
+
+        bool tooLong = newBucket->entries.size() > MAX_BUCKET_SIZE;
+        long long sizeDelta = (long long)newBucket->entries.size() - (long long)bucket->entries.size();
+        if (slot.compareExchange(bucket.get(), std::move(newBucket))) {
+            counter.add(sizeDelta);
+            if (tooLong)
+                grow(current);
+            return true;
+        }
+    }
+}
+
+template<typename Key, typename Value, typename Hash>
+void LFHashMap<Key, Value, Hash>::grow(const SharedPtr<Table> &current) {
+    // table which is a migration target itself should finish migration first
+    if (table.getFast().get() != current.get() || current->next.getFast().get() != nullptr)
+        return;
+    if (counter.load() <= (long long)(current->capacity * MAX_LOAD_FACTOR))
+        return;
+
+    current->next.compareExchange(nullptr, SharedPtr<Table>(new Table(current->capacity * 2)));
+}
+
+template<typename Key, typename Value, typename Hash>
+void LFHashMap<Key, Value, Hash>::migrate(const SharedPtr<Table> &current, size_t index) {
+    AtomicSharedPtr<Bucket> &slot = current->buckets[index];
+    SharedPtr<Bucket> bucket = slot.get();
+    while (!bucket->frozen) {
+        SharedPtr<Bucket> frozen(new Bucket{bucket->entries, true});
+        slot.compareExchange(bucket.get(), std::move(frozen));
+        bucket = slot.get();
+    }
+
+    SharedPtr<Table> next = current->next.get();
+    size_t targets[] = {index + current->capacity, index};
+    for (size_t target : targets) {
+        if (next->buckets[target].getFast().get() != nullptr)
+            continue;
+
+        SharedPtr<Bucket> part(new Bucket());
+        for (const Entry &entry : bucket->entries)
+            if ((entry.hash & (next->capacity - 1)) == target)
+                part->entries.push_back(entry);
+
+        // bucket `index` is created last, so whoever creates it finishes migration of old bucket
+        if (next->buckets[target].compareExchange(nullptr, std::move(part)) && target == index) {
+            if (current->migrated.fetch_add(1) + 1 == current->capacity)
+                table.compareExchange(current.get(), std::move(next));
+        }
+    }
+}
+
+} // namespace LFStructs
@@ -1,8 +1,19 @@
 #pragma once
 
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "atomic_shared_ptr.h"
+#include "flat_combining.h"
+#include "lfmap_batch.h"
+#include "lfmap_persistence.h"
+#include "lfmap_snapshot.h"
 
 namespace LFStructs {
 
@@ -15,6 +26,8 @@ class LFMap {
         Key key;
         Value data;
         int size;
+        // treap heap order: parent priority is not less than children ones
+        unsigned priority;
 
         void updateSize() {
             size = (left.get() == nullptr ? 0 : left->size) + (right.get() == nullptr ? 0 : right->size) + 1;
@@ -22,22 +35,175 @@ class LFMap {
     };
 
 public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using Snapshot = MapSnapshot<Node, Key, Value>;
+    using ReadSession = MapReadSession<LFMap>;
+    using BatchOperation = MapBatchOperation<Key, Value>;
+
     LFMap() = default;
+    explicit LFMap(WriteMode mode);
+    // builds map from pairs with strictly increasing keys in O(n), subtrees are built by threadCount threads
+    template<typename Iterator>
+    LFMap(BulkLoadTag, Iterator begin, Iterator end, size_t threadCount = 1);
+    template<typename Iterator>
+    static LFMap fromSorted(Iterator begin, Iterator end, size_t threadCount = 1) {
+        return LFMap(bulkLoad, begin, end, threadCount);
+    }
 
     void upsert(Key key, Value value);
     std::optional<Value> get(Key key);
+    // looks up all keys under one pinned root, out[i] is value of keys[i]
+    void multiGet(const std::vector<Key> &keys, std::vector<std::optional<Value>> &out);
     void remove(Key key);
 
+    // these run fn inside the CAS retry loop, so fn may be called several times and should have no side effects;
+    // they always write directly, even in WriteMode::Combining
+    using ComputeFunction = std::function<std::optional<Value>(const std::optional<Value>&)>;
+    // fn gets current value (empty if key is absent) and returns new one, empty result erases key; returns new value
+    std::optional<Value> compute(Key key, const ComputeFunction &fn);
+    // changes existing value only, returns new value or empty if key is absent
+    std::optional<Value> update(Key key, const std::function<Value(const Value&)> &fn);
+    // returns value stored after the call: existing one or inserted
+    Value insertIfAbsent(Key key, Value value);
+    // sets desired if key holds expected, returns whether it did
+    bool compareAndSet(Key key, Value expected, Value desired);
+
+    // applies all writes atomically with one root CAS, later writes to the same key win
+    void applyBatch(std::vector<BatchOperation> ops);
+
+    Snapshot snapshot();
+    ReadSession readSession() { return ReadSession(*this); }
+    // writes consistent snapshot sorted by key to binary file, returns false on I/O error
+    bool saveSnapshot(const std::string &path);
+    // replaces whole content with file written by saveSnapshot, tree is built in O(n) and published with one store
+    bool loadSnapshot(const std::string &path);
+
+    // exact size of current version in O(1), it is kept in every node
+    size_t size();
+    size_t approxSize() { return size(); }
+    // number of keys less than given one
+    size_t rank(Key key);
+    // k-th smallest element, 0-based
+    std::optional<std::pair<Key, Value>> select(size_t k);
+    // number of keys in [lo, hi)
+    size_t countRange(Key lo, Key hi);
+
 private:
-    static std::pair<SharedPtr<Node>, SharedPtr<Node>> splitLess(const SharedPtr<Node> &root, Key key);
-    static std::pair<SharedPtr<Node>, SharedPtr<Node>> splitLessEq(const SharedPtr<Node> &root, Key key);
-    SharedPtr<Node> merge(const SharedPtr<Node> &left, const SharedPtr<Node> &right);
+    using BatchIterator = typename std::vector<BatchOperation>::const_iterator;
+
+    // one step of search path, collected into thread local buffer by writers
+    struct PathStep {
+        const Node *node;
+        bool toLeft;
+    };
 
-    AtomicSharedPtr<Node> root;
+    std::function<void(std::vector<BatchOperation>&)> applyBatchCallback() {
+        return [this](std::vector<BatchOperation> &ops) { applyBatch(std::move(ops)); };
+    }
+
+    static unsigned randomPriority();
+    static const Node* find(const Node *root, const Key &key);
+
+    // both return root itself if nothing changed
+    static SharedPtr<Node> upsert(const SharedPtr<Node> &root, const Key &key, const Value &value, unsigned priority);
+    static SharedPtr<Node> remove(const SharedPtr<Node> &root, const Key &key);
+    // copies path bottom-up around new child, rotating child up while its priority is bigger
+    static SharedPtr<Node> rebuildPath(const std::vector<PathStep> &path, SharedPtr<Node> child);
+    static SharedPtr<Node> merge(const SharedPtr<Node> &left, const SharedPtr<Node> &right);
+    static SharedPtr<Node> join(const SharedPtr<Node> &left, Key key, Value data, unsigned priority, const SharedPtr<Node> &right);
+    static SharedPtr<Node> copyNode(const Node *node);
+
+    SharedPtr<Node> applyBatch(const SharedPtr<Node> &root, BatchIterator first, BatchIterator last);
+    static SharedPtr<Node> build(BatchIterator first, BatchIterator last);
+    // builds treap from count entries sorted by key, read(i, key, value) fills i-th one
+    template<typename Reader>
+    static SharedPtr<Node> build(size_t count, const Reader &read);
+    // perfectly balanced, random priorities are sorted and given out by level
+    template<typename Reader>
+    static SharedPtr<Node> buildBalanced(size_t count, const Reader &read, size_t threadCount);
+    template<typename Reader>
+    static SharedPtr<Node> buildBalanced(const Reader &read, const std::vector<unsigned> &priorities,
+                                         size_t first, size_t last, size_t heapIndex, size_t threadCount);
+
+    alignas(CACHE_LINE_SIZE) AtomicSharedPtr<Node> root;
+    std::unique_ptr<FlatCombiner<BatchOperation>> combiner;
 };
 
+template<typename Key, typename Value>
+LFMap<Key, Value>::LFMap(WriteMode mode) {
+    if (mode == WriteMode::Combining)
+        combiner.reset(new FlatCombiner<BatchOperation>());
+}
+
+template<typename Key, typename Value>
+template<typename Iterator>
+LFMap<Key, Value>::LFMap(BulkLoadTag, Iterator begin, Iterator end, size_t threadCount) {
+    root.store(buildFromRange<Key, Value>(begin, end, [threadCount](size_t count, const auto &read) {
+        return buildBalanced(count, read, threadCount);
+    }));
+}
+
+template<typename Key, typename Value>
+typename LFMap<Key, Value>::Snapshot LFMap<Key, Value>::snapshot() {
+    return Snapshot(root.get());
+}
+
+template<typename Key, typename Value>
+bool LFMap<Key, Value>::saveSnapshot(const std::string &path) {
+    return writeSnapshotFile<Key, Value>(snapshot(), path);
+}
+
+template<typename Key, typename Value>
+bool LFMap<Key, Value>::loadSnapshot(const std::string &path) {
+    MappedSnapshotFile<Key, Value> file(path);
+    if (!file.valid())
+        return false;
+
+    root.store(buildBalanced(file.size(), [&file](size_t index, Key &key, Value &value) { file.read(index, key, value); }, 1));
+    return true;
+}
+
+template<typename Key, typename Value>
+void LFMap<Key, Value>::multiGet(const std::vector<Key> &keys, std::vector<std::optional<Value>> &out) {
+    FastSharedPtr<Node> rootCopy = root.getFast();
+    subtreeMultiGet(rootCopy.get(), keys, out);
+}
+
+template<typename Key, typename Value>
+size_t LFMap<Key, Value>::size() {
+    FastSharedPtr<Node> rootCopy = root.getFast();
+    return subtreeSize(rootCopy.get());
+}
+
+template<typename Key, typename Value>
+size_t LFMap<Key, Value>::rank(Key key) {
+    FastSharedPtr<Node> rootCopy = root.getFast();
+    return subtreeRank(rootCopy.get(), key);
+}
+
+template<typename Key, typename Value>
+std::optional<std::pair<Key, Value>> LFMap<Key, Value>::select(size_t k) {
+    FastSharedPtr<Node> rootCopy = root.getFast();
+    const Node *node = subtreeSelect(rootCopy.get(), k);
+    if (node == nullptr)
+        return {};
+
+    return std::make_pair(node->key, node->data);
+}
+
+template<typename Key, typename Value>
+size_t LFMap<Key, Value>::countRange(Key lo, Key hi) {
+    if (!(lo < hi))
+        return 0;
+
+    FastSharedPtr<Node> rootCopy = root.getFast();
+    return subtreeRank(rootCopy.get(), hi) - subtreeRank(rootCopy.get(), lo);
+}
+
 template<typename Key, typename Value>
 std::optional<Value> LFMap<Key, Value>::get(Key key) {
+    LATENCY_SCOPE(LatencyOp::Get);
     FastSharedPtr<Node> rootCopy = root.getFast();
     Node *node = rootCopy.get();
     while (node != nullptr) {
@@ -54,17 +220,16 @@ std::optional<Value> LFMap<Key, Value>::get(Key key) {
 
 template<typename Key, typename Value>
 void LFMap<Key, Value>::upsert(Key key, Value value) {
-    SharedPtr node(new Node());
-    node->key = key;
-    node->data = value;
-    node->size = 1;
+    LATENCY_SCOPE(LatencyOp::Upsert);
+    if (combiner && combiner->execute(BatchOperation::upsert(key, value), applyBatchCallback()))
+        return;
 
+    unsigned priority = randomPriority();
     while (true) {
         SharedPtr<Node> rootCopy = root.get();
-        auto [left, right] = splitLess(rootCopy, key);
-        auto [rightLeft, rightRight] = splitLessEq(right, key);
-
-        SharedPtr<Node> newRoot = merge(left, merge(node, rightRight));
+        SharedPtr<Node> newRoot = upsert(rootCopy, key, value, priority);
+        if (newRoot.get() == rootCopy.get())
+            return;
         if (root.compareExchange(rootCopy.get(), std::move(newRoot)))
             return;
     }
@@ -72,102 +237,376 @@ void LFMap<Key, Value>::upsert(Key key, Value value) {
 
 template<typename Key, typename Value>
 void LFMap<Key, Value>::remove(Key key) {
+    LATENCY_SCOPE(LatencyOp::Remove);
+    if (combiner && combiner->execute(BatchOperation::remove(key), applyBatchCallback()))
+        return;
+
     while (true) {
         SharedPtr<Node> rootCopy = root.get();
-        auto [left, right] = splitLess(rootCopy, key);
-        auto [rightLeft, rightRight] = splitLessEq(right, key);
-
-        SharedPtr<Node> newRoot = merge(left, rightRight);
+        SharedPtr<Node> newRoot = remove(rootCopy, key);
+        if (newRoot.get() == rootCopy.get())
+            return;
         if (root.compareExchange(rootCopy.get(), std::move(newRoot)))
             return;
     }
 }
 
+/* Descends once without recursion and copies only ancestors of changed node.
+ * Existing key keeps its place and priority, new key is added as a leaf and
+ * rotated up while its priority is bigger than parent one. */
 template<typename Key, typename Value>
-SharedPtr<typename LFMap<Key, Value>::Node> LFMap<Key, Value>::merge(const SharedPtr<Node> &left, const SharedPtr<Node> &right) {
-    if (left.get() == nullptr)
-        return right;
-    if (right.get() == nullptr)
-        return left;
-
-    SharedPtr<Node> root(new Node());
-    root->size = left->size + right->size;
-    if (rand() * uint64_t(left->size + right->size) < left->size * RAND_MAX) {
-        root->key = left->key;
-        root->data = left->data;
-        root->left = left->left;
-        root->right = merge(left->right, right);
+SharedPtr<typename LFMap<Key, Value>::Node>
+LFMap<Key, Value>::upsert(const SharedPtr<Node> &root, const Key &key, const Value &value, unsigned priority) {
+    thread_local std::vector<PathStep> path;
+    path.clear();
+
+    const Node *node = root.get();
+    while (node != nullptr && (node->key < key || key < node->key)) {
+        bool toLeft = key < node->key;
+        path.push_back({node, toLeft});
+        node = (toLeft ? node->left : node->right).get();
+    }
+
+    if (node != nullptr && sameValue(node->data, value))
+        return root;
+
+    SharedPtr<Node> child(new Node());
+    child->key = key;
+    child->data = value;
+    if (node == nullptr) {
+        child->priority = priority;
+        child->size = 1;
     } else {
-        root->key = right->key;
-        root->data = right->data;
-        root->left = merge(left, right->left);
-        root->right = right->right;
+        child->priority = node->priority;
+        child->size = node->size;
+        child->left = node->left;
+        child->right = node->right;
     }
 
-    return root;
+    return rebuildPath(path, std::move(child));
 }
 
 template<typename Key, typename Value>
-std::pair<SharedPtr<typename LFMap<Key, Value>::Node>, SharedPtr<typename LFMap<Key, Value>::Node>>
-LFMap<Key, Value>::splitLess(const SharedPtr<Node> &root, Key key) {
-    if (root.get() == nullptr)
-        return {root, root};
+SharedPtr<typename LFMap<Key, Value>::Node> LFMap<Key, Value>::remove(const SharedPtr<Node> &root, const Key &key) {
+    thread_local std::vector<PathStep> path;
+    path.clear();
+
+    const Node *node = root.get();
+    while (node != nullptr && (node->key < key || key < node->key)) {
+        bool toLeft = key < node->key;
+        path.push_back({node, toLeft});
+        node = (toLeft ? node->left : node->right).get();
+    }
+
+    if (node == nullptr)
+        return root;
 
-    if (root->key < key) {
-        auto [rightLeft, rightRight] = splitLess(root->right, key);
+    return rebuildPath(path, merge(node->left, node->right));
+}
 
-        SharedPtr node(new Node());
-        node->key = root->key;
-        node->data = root->data;
-        node->left = root->left;
-        node->right = rightLeft;
+template<typename Key, typename Value>
+SharedPtr<typename LFMap<Key, Value>::Node>
+LFMap<Key, Value>::rebuildPath(const std::vector<PathStep> &path, SharedPtr<Node> child) {
+    // every node built here is not published yet, so child can be changed in place
+    for (size_t i = path.size(); i > 0; i--) {
+        const Node *parent = path[i - 1].node;
+        SharedPtr<Node> node = copyNode(parent);
+        bool rotate = child.get() != nullptr && child->priority > parent->priority;
+        if (path[i - 1].toLeft) {
+            node->left = rotate ? std::move(child->right) : std::move(child);
+            node->right = parent->right;
+        } else {
+            node->left = parent->left;
+            node->right = rotate ? std::move(child->left) : std::move(child);
+        }
         node->updateSize();
 
-        return {node, rightRight};
-    } else {
-        auto [leftLeft, leftRight] = splitLess(root->left, key);
+        if (rotate) {
+            (path[i - 1].toLeft ? child->right : child->left) = std::move(node);
+            child->updateSize();
+        } else {
+            child = std::move(node);
+        }
+    }
 
-        SharedPtr node(new Node());
-        node->key = root->key;
-        node->data = root->data;
-        node->left = leftRight;
-        node->right = root->right;
-        node->updateSize();
+    return child;
+}
 
-        return {leftLeft, node};
+template<typename Key, typename Value>
+std::optional<Value> LFMap<Key, Value>::compute(Key key, const ComputeFunction &fn) {
+    unsigned priority = randomPriority();
+    while (true) {
+        SharedPtr<Node> rootCopy = root.get();
+        const Node *node = find(rootCopy.get(), key);
+        std::optional<Value> result = fn(node ? std::optional<Value>(node->data) : std::nullopt);
+
+        SharedPtr<Node> newRoot = result ? upsert(rootCopy, key, *result, priority) : remove(rootCopy, key);
+        if (newRoot.get() == rootCopy.get() || root.compareExchange(rootCopy.get(), std::move(newRoot)))
+            return result;
     }
 }
 
 template<typename Key, typename Value>
-std::pair<SharedPtr<typename LFMap<Key, Value>::Node>, SharedPtr<typename LFMap<Key, Value>::Node>>
-LFMap<Key, Value>::splitLessEq(const SharedPtr<Node> &root, Key key) {
-    if (root.get() == nullptr)
-        return {root, root};
+std::optional<Value> LFMap<Key, Value>::update(Key key, const std::function<Value(const Value&)> &fn) {
+    return compute(key, [&fn](const std::optional<Value> &current) -> std::optional<Value> {
+        if (!current)
+            return {};
+        return fn(*current);
+    });
+}
 
-    if (!(key < root->key)) {
-        auto [rightLeft, rightRight] = splitLessEq(root->right, key);
+template<typename Key, typename Value>
+Value LFMap<Key, Value>::insertIfAbsent(Key key, Value value) {
+    return *compute(key, [&value](const std::optional<Value> &current) {
+        return current ? current : std::optional<Value>(value);
+    });
+}
 
-        SharedPtr node(new Node());
-        node->key = root->key;
-        node->data = root->data;
-        node->left = root->left;
-        node->right = rightLeft;
-        node->updateSize();
+template<typename Key, typename Value>
+bool LFMap<Key, Value>::compareAndSet(Key key, Value expected, Value desired) {
+    bool success = false;
+    compute(key, [&](const std::optional<Value> &current) {
+        success = current && *current == expected;
+        return success ? std::optional<Value>(desired) : current;
+    });
+
+    return success;
+}
+
+template<typename Key, typename Value>
+void LFMap<Key, Value>::applyBatch(std::vector<BatchOperation> ops) {
+    ops = normalizeBatch(std::move(ops));
+    if (ops.empty())
+        return;
+
+    while (true) {
+        SharedPtr<Node> rootCopy = root.get();
+        SharedPtr<Node> newRoot = applyBatch(rootCopy, ops.cbegin(), ops.cend());
+        if (newRoot.get() == rootCopy.get())
+            return;
+        if (root.compareExchange(rootCopy.get(), std::move(newRoot)))
+            return;
+    }
+}
+
+template<typename Key, typename Value>
+SharedPtr<typename LFMap<Key, Value>::Node>
+LFMap<Key, Value>::applyBatch(const SharedPtr<Node> &root, BatchIterator first, BatchIterator last) {
+    if (first == last)
+        return root;
+
+    if (root.get() == nullptr) {
+        if (std::all_of(first, last, [](const auto &op) { return bool(op.value); }))
+            return build(first, last);
+
+        std::vector<BatchOperation> upserts;
+        std::copy_if(first, last, std::back_inserter(upserts), [](const auto &op) { return bool(op.value); });
+        return build(upserts.cbegin(), upserts.cend());
+    }
+
+    auto less = std::lower_bound(first, last, root->key, [](const auto &op, const Key &key) { return op.key < key; });
+    auto greater = less;
+    if (greater != last && !(root->key < greater->key))
+        greater++;
+
+    SharedPtr<Node> newLeft = applyBatch(root->left, first, less);
+    SharedPtr<Node> newRight = applyBatch(root->right, greater, last);
+    if (less != greater && !less->value)
+        return merge(newLeft, newRight);
+    bool sameData = less == greater || sameValue(*less->value, root->data);
+    if (sameData && newLeft.get() == root->left.get() && newRight.get() == root->right.get())
+        return root;
+
+    return join(newLeft, root->key, less != greater ? *less->value : root->data, root->priority, newRight);
+}
+
+template<typename Key, typename Value>
+SharedPtr<typename LFMap<Key, Value>::Node> LFMap<Key, Value>::build(BatchIterator first, BatchIterator last) {
+    return build(last - first, [first](size_t index, Key &key, Value &value) {
+        key = first[index].key;
+        value = *first[index].value;
+    });
+}
+
+// O(n) as a cartesian tree of random priorities, same shape as n random inserts would give
+template<typename Key, typename Value>
+template<typename Reader>
+SharedPtr<typename LFMap<Key, Value>::Node> LFMap<Key, Value>::build(size_t count, const Reader &read) {
+    // right spine of tree built so far, nodes are not published yet and can be changed
+    std::vector<SharedPtr<Node>> spine;
+    for (size_t i = 0; i < count; i++) {
+        SharedPtr<Node> node(new Node());
+        read(i, node->key, node->data);
+        node->priority = randomPriority();
+
+        SharedPtr<Node> popped;
+        while (spine.size() && spine.back()->priority < node->priority) {
+            spine.back()->updateSize();
+            popped = std::move(spine.back());
+            spine.pop_back();
+        }
+        node->left = std::move(popped);
+        if (spine.size())
+            spine.back()->right = node;
+        spine.push_back(std::move(node));
+    }
+
+    for (size_t i = spine.size(); i > 0; i--)
+        spine[i - 1]->updateSize();
 
-        return {node, rightRight};
+    return spine.size() ? spine[0] : SharedPtr<Node>();
+}
+
+template<typename Key, typename Value>
+template<typename Reader>
+SharedPtr<typename LFMap<Key, Value>::Node> LFMap<Key, Value>::buildBalanced(size_t count, const Reader &read, size_t threadCount) {
+    // node with heap index h (root is 1, children of h are 2h and 2h + 1) gets priorities[h - 1]
+    size_t slots = 1;
+    while (slots < count)
+        slots = slots * 2 + 1;
+
+    /* Sorted uniform values without sorting: k-th smallest of n is sum of first k
+     * exponential gaps divided by sum of all n + 1. Generator is replayed twice,
+     * to get total first and values then, so gaps don't have to be stored. */
+    std::mt19937_64 generator(randomPriority());
+    std::mt19937_64 replay = generator;
+    double total = 0;
+    std::exponential_distribution<double> totalGap;
+    for (size_t i = 0; i <= slots; i++)
+        total += totalGap(replay);
+
+    std::vector<unsigned> priorities(slots);
+    double sum = 0;
+    std::exponential_distribution<double> gap;
+    for (size_t i = 0; i < slots; i++) {
+        sum += gap(generator);
+        // same range as randomPriority(), so later inserts compete with bulk loaded nodes fairly
+        priorities[slots - i - 1] = unsigned(sum / total * std::minstd_rand::max());
+    }
+
+    return buildBalanced(read, priorities, 0, count, 1, threadCount);
+}
+
+template<typename Key, typename Value>
+template<typename Reader>
+SharedPtr<typename LFMap<Key, Value>::Node>
+LFMap<Key, Value>::buildBalanced(const Reader &read, const std::vector<unsigned> &priorities,
+                                 size_t first, size_t last, size_t heapIndex, size_t threadCount) {
+    if (first == last)
+        return {};
+
+    size_t middle = first + (last - first) / 2;
+    SharedPtr<Node> node(new Node());
+    read(middle, node->key, node->data);
+    node->priority = priorities[heapIndex - 1];
+    if (threadCount > 1 && last - first >= PARALLEL_BUILD_THRESHOLD) {
+        std::thread leftBuilder([&]() {
+            node->left = buildBalanced(read, priorities, first, middle, heapIndex * 2, threadCount / 2);
+        });
+        node->right = buildBalanced(read, priorities, middle + 1, last, heapIndex * 2 + 1, threadCount - threadCount / 2);
+        leftBuilder.join();
     } else {
-        auto [leftLeft, leftRight] = splitLessEq(root->left, key);
+        node->left = buildBalanced(read, priorities, first, middle, heapIndex * 2, 1);
+        node->right = buildBalanced(read, priorities, middle + 1, last, heapIndex * 2 + 1, 1);
+    }
+    node->updateSize();
 
-        SharedPtr node(new Node());
-        node->key = root->key;
-        node->data = root->data;
-        node->left = leftRight;
-        node->right = root->right;
-        node->updateSize();
+    return node;
+}
+
+// joins two treaps with all keys of left < key < all keys of right
+template<typename Key, typename Value>
+SharedPtr<typename LFMap<Key, Value>::Node>
+LFMap<Key, Value>::join(const SharedPtr<Node> &left, Key key, Value data, unsigned priority, const SharedPtr<Node> &right) {
+    // goes down along inner spines, every new node is linked into the hole of its parent
+    SharedPtr<Node> res;
+    SharedPtr<Node> *hole = &res;
+    const SharedPtr<Node> *l = &left;
+    const SharedPtr<Node> *r = &right;
+    while (true) {
+        int size = subtreeSize(l->get()) + subtreeSize(r->get()) + 1;
+        if (l->get() != nullptr && (*l)->priority > priority &&
+                (r->get() == nullptr || (*l)->priority >= (*r)->priority)) {
+            *hole = copyNode(l->get());
+            (*hole)->size = size;
+            (*hole)->left = (*l)->left;
+            l = &(*l)->right;
+            hole = &(*hole)->right;
+        } else if (r->get() != nullptr && (*r)->priority > priority) {
+            *hole = copyNode(r->get());
+            (*hole)->size = size;
+            (*hole)->right = (*r)->right;
+            r = &(*r)->left;
+            hole = &(*hole)->left;
+        } else {
+            *hole = SharedPtr<Node>(new Node());
+            (*hole)->key = std::move(key);
+            (*hole)->data = std::move(data);
+            (*hole)->priority = priority;
+            (*hole)->size = size;
+            (*hole)->left = *l;
+            (*hole)->right = *r;
+            return res;
+        }
+    }
+}
+
+// copies everything except children and size
+template<typename Key, typename Value>
+SharedPtr<typename LFMap<Key, Value>::Node> LFMap<Key, Value>::copyNode(const Node *node) {
+    SharedPtr<Node> res(new Node());
+    res->key = node->key;
+    res->data = node->data;
+    res->priority = node->priority;
+    return res;
+}
 
-        return {leftLeft, node};
+template<typename Key, typename Value>
+const typename LFMap<Key, Value>::Node* LFMap<Key, Value>::find(const Node *root, const Key &key) {
+    while (root != nullptr) {
+        if (root->key < key)
+            root = root->right.get();
+        else if (key < root->key)
+            root = root->left.get();
+        else
+            return root;
     }
+
+    return nullptr;
+}
+
+template<typename Key, typename Value>
+unsigned LFMap<Key, Value>::randomPriority() {
+    // glibc rand() takes global lock, every thread gets its own generator instead
+    thread_local std::minstd_rand generator(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return generator();
 }
 
+template<typename Key, typename Value>
+SharedPtr<typename LFMap<Key, Value>::Node> LFMap<Key, Value>::merge(const SharedPtr<Node> &left, const SharedPtr<Node> &right) {
+    SharedPtr<Node> res;
+    SharedPtr<Node> *hole = &res;
+    const SharedPtr<Node> *l = &left;
+    const SharedPtr<Node> *r = &right;
+    while (l->get() != nullptr && r->get() != nullptr) {
+        int size = (*l)->size + (*r)->size;
+        if ((*l)->priority > (*r)->priority) {
+            *hole = copyNode(l->get());
+            (*hole)->size = size;
+            (*hole)->left = (*l)->left;
+            l = &(*l)->right;
+            hole = &(*hole)->right;
+        } else {
+            *hole = copyNode(r->get());
+            (*hole)->size = size;
+            (*hole)->right = (*r)->right;
+            r = &(*r)->left;
+            hole = &(*hole)->left;
+        }
+    }
+    *hole = l->get() != nullptr ? *l : *r;
+
+    return res;
+}
 
 } // namespace LFStructs
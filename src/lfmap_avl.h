@@ -1,8 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "atomic_shared_ptr.h"
+#include "flat_combining.h"
+#include "lfmap_batch.h"
+#include "lfmap_persistence.h"
+#include "lfmap_snapshot.h"
 
 namespace LFStructs {
 
@@ -15,35 +25,116 @@ class LFMapAvl {
         Key key;
         Value data;
         int height;
+        int size;
 
-        void updateHeight() {
+        void update() {
             height = std::max(LFMapAvl::height(left), LFMapAvl::height(right)) + 1;
+            size = subtreeSize(left.get()) + subtreeSize(right.get()) + 1;
         }
     };
 
 public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using Snapshot = MapSnapshot<Node, Key, Value>;
+    using ReadSession = MapReadSession<LFMapAvl>;
+    using BatchOperation = MapBatchOperation<Key, Value>;
+
     LFMapAvl() = default;
+    explicit LFMapAvl(WriteMode mode);
+    // builds map from pairs with strictly increasing keys in O(n), subtrees are built by threadCount threads
+    template<typename Iterator>
+    LFMapAvl(BulkLoadTag, Iterator begin, Iterator end, size_t threadCount = 1);
+    template<typename Iterator>
+    static LFMapAvl fromSorted(Iterator begin, Iterator end, size_t threadCount = 1) {
+        return LFMapAvl(bulkLoad, begin, end, threadCount);
+    }
 
     void upsert(Key key, Value data);
     std::optional<Value> get(Key key);
+    // looks up all keys under one pinned root, out[i] is value of keys[i]
+    void multiGet(const std::vector<Key> &keys, std::vector<std::optional<Value>> &out);
     void remove(Key key);
 
+    // these run fn inside the CAS retry loop, so fn may be called several times and should have no side effects;
+    // they always write directly, even in WriteMode::Combining
+    using ComputeFunction = std::function<std::optional<Value>(const std::optional<Value>&)>;
+    // fn gets current value (empty if key is absent) and returns new one, empty result erases key; returns new value
+    std::optional<Value> compute(Key key, const ComputeFunction &fn);
+    // changes existing value only, returns new value or empty if key is absent
+    std::optional<Value> update(Key key, const std::function<Value(const Value&)> &fn);
+    // returns value stored after the call: existing one or inserted
+    Value insertIfAbsent(Key key, Value value);
+    // sets desired if key holds expected, returns whether it did
+    bool compareAndSet(Key key, Value expected, Value desired);
+
+    // applies all writes atomically with one root CAS, later writes to the same key win
+    void applyBatch(std::vector<BatchOperation> ops);
+
+    Snapshot snapshot();
+    ReadSession readSession() { return ReadSession(*this); }
+    // writes consistent snapshot sorted by key to binary file, returns false on I/O error
+    bool saveSnapshot(const std::string &path);
+    // replaces whole content with file written by saveSnapshot, tree is built in O(n) and published with one store
+    bool loadSnapshot(const std::string &path);
+
+    // exact size of current version in O(1), it is kept in every node
+    size_t size();
+    size_t approxSize() { return size(); }
+    // number of keys less than given one
+    size_t rank(Key key);
+    // k-th smallest element, 0-based
+    std::optional<std::pair<Key, Value>> select(size_t k);
+    // number of keys in [lo, hi)
+    size_t countRange(Key lo, Key hi);
+
 private:
+    using BatchIterator = typename std::vector<BatchOperation>::const_iterator;
+
+    // one step of search path, collected into thread local buffer by writers
+    struct PathStep {
+        const Node *node;
+        bool toLeft;
+    };
+
+    std::function<void(std::vector<BatchOperation>&)> applyBatchCallback() {
+        return [this](std::vector<BatchOperation> &ops) { applyBatch(std::move(ops)); };
+    }
+
     static int height(const SharedPtr<Node> &node);
+    static const Node* find(const Node *root, const Key &key);
+    static SharedPtr<Node> makeNode(Key key, Value data, SharedPtr<Node> left, SharedPtr<Node> right);
 
-    SharedPtr<Node> rotateLeft(const SharedPtr<Node> &root);
-    SharedPtr<Node> rotateRight(const SharedPtr<Node> &root);
-    SharedPtr<Node> bigRotateLeft(const SharedPtr<Node> &root);
-    SharedPtr<Node> bigRotateRight(const SharedPtr<Node> &root);
+    SharedPtr<Node> rotateLeft(SharedPtr<Node> root);
+    SharedPtr<Node> rotateRight(SharedPtr<Node> root);
+    SharedPtr<Node> bigRotateLeft(SharedPtr<Node> root);
+    SharedPtr<Node> bigRotateRight(SharedPtr<Node> root);
 
     SharedPtr<Node> upsert(const SharedPtr<Node> &root, Key key, Value data);
     SharedPtr<Node> remove(const SharedPtr<Node> &root, Key key);
+    SharedPtr<Node> rebuildPath(const std::vector<PathStep> &path, size_t replaced, const Node *replacement, SharedPtr<Node> child);
+
+    // root should be a fresh node which is not published yet
+    SharedPtr<Node> balance(SharedPtr<Node> root);
 
-    SharedPtr<Node> balance(const SharedPtr<Node> &root);
+    SharedPtr<Node> join(const SharedPtr<Node> &left, Key key, Value data, const SharedPtr<Node> &right);
+    SharedPtr<Node> join(const SharedPtr<Node> &left, const SharedPtr<Node> &right);
+    SharedPtr<Node> applyBatch(const SharedPtr<Node> &root, BatchIterator first, BatchIterator last);
+    static SharedPtr<Node> build(BatchIterator first, BatchIterator last);
+    // builds tree from entries [first, last) sorted by key, read(i, key, value) fills i-th one
+    template<typename Reader>
+    static SharedPtr<Node> build(const Reader &read, size_t first, size_t last, size_t threadCount = 1);
 
-    AtomicSharedPtr<Node> treeRoot;
+    alignas(CACHE_LINE_SIZE) AtomicSharedPtr<Node> treeRoot;
+    std::unique_ptr<FlatCombiner<BatchOperation>> combiner;
 };
 
+template<typename Key, typename Value>
+LFMapAvl<Key, Value>::LFMapAvl(WriteMode mode) {
+    if (mode == WriteMode::Combining)
+        combiner.reset(new FlatCombiner<BatchOperation>());
+}
+
 template<typename Key, typename Value>
 int LFMapAvl<Key, Value>::height(const SharedPtr<LFMapAvl::Node> &node) {
     if (node.get() == nullptr)
@@ -52,28 +143,187 @@ int LFMapAvl<Key, Value>::height(const SharedPtr<LFMapAvl::Node> &node) {
         return node.get()->height;
 }
 
+template<typename Key, typename Value>
+const typename LFMapAvl<Key, Value>::Node* LFMapAvl<Key, Value>::find(const Node *root, const Key &key) {
+    while (root != nullptr) {
+        if (root->key == key)
+            return root;
+        else if (root->key < key)
+            root = root->right.get();
+        else
+            root = root->left.get();
+    }
+
+    return nullptr;
+}
+
+template<typename Key, typename Value>
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::makeNode(Key key, Value data, SharedPtr<Node> left, SharedPtr<Node> right) {
+    SharedPtr<Node> node(new Node());
+    node->key = std::move(key);
+    node->data = std::move(data);
+    node->left = std::move(left);
+    node->right = std::move(right);
+    node->update();
+    return node;
+}
+
 template<typename Key, typename Value>
 void LFMapAvl<Key, Value>::upsert(Key key, Value data) {
+    LATENCY_SCOPE(LatencyOp::Upsert);
+    if (combiner && combiner->execute(BatchOperation::upsert(key, data), applyBatchCallback()))
+        return;
+
     while (true) {
         auto root = treeRoot.get();
         auto newRoot = upsert(root, key, data);
+        if (newRoot.get() == root.get())
+            return;
         if (treeRoot.compareExchange(root.get(), std::move(newRoot)))
             break;
     }
 }
 
+template<typename Key, typename Value>
+void LFMapAvl<Key, Value>::applyBatch(std::vector<BatchOperation> ops) {
+    ops = normalizeBatch(std::move(ops));
+    if (ops.empty())
+        return;
+
+    while (true) {
+        auto root = treeRoot.get();
+        auto newRoot = applyBatch(root, ops.cbegin(), ops.cend());
+        if (newRoot.get() == root.get())
+            return;
+        if (treeRoot.compareExchange(root.get(), std::move(newRoot)))
+            return;
+    }
+}
+
 template<typename Key, typename Value>
 void LFMapAvl<Key, Value>::remove(Key key) {
+    LATENCY_SCOPE(LatencyOp::Remove);
+    if (combiner && combiner->execute(BatchOperation::remove(key), applyBatchCallback()))
+        return;
+
     while (true) {
         auto root = treeRoot.get();
         auto newRoot = remove(root, key);
+        if (newRoot.get() == root.get())
+            return;
         if (treeRoot.compareExchange(root.get(), std::move(newRoot)))
             return;
     }
 }
 
+template<typename Key, typename Value>
+std::optional<Value> LFMapAvl<Key, Value>::compute(Key key, const ComputeFunction &fn) {
+    while (true) {
+        auto root = treeRoot.get();
+        const Node *node = find(root.get(), key);
+        std::optional<Value> result = fn(node ? std::optional<Value>(node->data) : std::nullopt);
+
+        auto newRoot = result ? upsert(root, key, *result) : remove(root, key);
+        if (newRoot.get() == root.get() || treeRoot.compareExchange(root.get(), std::move(newRoot)))
+            return result;
+    }
+}
+
+template<typename Key, typename Value>
+std::optional<Value> LFMapAvl<Key, Value>::update(Key key, const std::function<Value(const Value&)> &fn) {
+    return compute(key, [&fn](const std::optional<Value> &current) -> std::optional<Value> {
+        if (!current)
+            return {};
+        return fn(*current);
+    });
+}
+
+template<typename Key, typename Value>
+Value LFMapAvl<Key, Value>::insertIfAbsent(Key key, Value value) {
+    return *compute(key, [&value](const std::optional<Value> &current) {
+        return current ? current : std::optional<Value>(value);
+    });
+}
+
+template<typename Key, typename Value>
+bool LFMapAvl<Key, Value>::compareAndSet(Key key, Value expected, Value desired) {
+    bool success = false;
+    compute(key, [&](const std::optional<Value> &current) {
+        success = current && *current == expected;
+        return success ? std::optional<Value>(desired) : current;
+    });
+
+    return success;
+}
+
+template<typename Key, typename Value>
+template<typename Iterator>
+LFMapAvl<Key, Value>::LFMapAvl(BulkLoadTag, Iterator begin, Iterator end, size_t threadCount) {
+    treeRoot.store(buildFromRange<Key, Value>(begin, end, [threadCount](size_t count, const auto &read) {
+        return build(read, 0, count, threadCount);
+    }));
+}
+
+template<typename Key, typename Value>
+typename LFMapAvl<Key, Value>::Snapshot LFMapAvl<Key, Value>::snapshot() {
+    return Snapshot(treeRoot.get());
+}
+
+template<typename Key, typename Value>
+bool LFMapAvl<Key, Value>::saveSnapshot(const std::string &path) {
+    return writeSnapshotFile<Key, Value>(snapshot(), path);
+}
+
+template<typename Key, typename Value>
+bool LFMapAvl<Key, Value>::loadSnapshot(const std::string &path) {
+    MappedSnapshotFile<Key, Value> file(path);
+    if (!file.valid())
+        return false;
+
+    treeRoot.store(build([&file](size_t index, Key &key, Value &value) { file.read(index, key, value); }, 0, file.size()));
+    return true;
+}
+
+template<typename Key, typename Value>
+void LFMapAvl<Key, Value>::multiGet(const std::vector<Key> &keys, std::vector<std::optional<Value>> &out) {
+    FastSharedPtr<Node> rootCopy = treeRoot.getFast();
+    subtreeMultiGet(rootCopy.get(), keys, out);
+}
+
+template<typename Key, typename Value>
+size_t LFMapAvl<Key, Value>::size() {
+    FastSharedPtr<Node> rootCopy = treeRoot.getFast();
+    return subtreeSize(rootCopy.get());
+}
+
+template<typename Key, typename Value>
+size_t LFMapAvl<Key, Value>::rank(Key key) {
+    FastSharedPtr<Node> rootCopy = treeRoot.getFast();
+    return subtreeRank(rootCopy.get(), key);
+}
+
+template<typename Key, typename Value>
+std::optional<std::pair<Key, Value>> LFMapAvl<Key, Value>::select(size_t k) {
+    FastSharedPtr<Node> rootCopy = treeRoot.getFast();
+    const Node *node = subtreeSelect(rootCopy.get(), k);
+    if (node == nullptr)
+        return {};
+
+    return std::make_pair(node->key, node->data);
+}
+
+template<typename Key, typename Value>
+size_t LFMapAvl<Key, Value>::countRange(Key lo, Key hi) {
+    if (!(lo < hi))
+        return 0;
+
+    FastSharedPtr<Node> rootCopy = treeRoot.getFast();
+    return subtreeRank(rootCopy.get(), hi) - subtreeRank(rootCopy.get(), lo);
+}
+
 template<typename Key, typename Value>
 std::optional<Value> LFMapAvl<Key, Value>::get(Key key) {
+    LATENCY_SCOPE(LatencyOp::Get);
     auto holder = treeRoot.getFast();
     Node *root = holder.get();
     while (root != nullptr) {
@@ -91,39 +341,78 @@ std::optional<Value> LFMapAvl<Key, Value>::get(Key key) {
 
 template<typename Key, typename Value>
 SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::upsert(const SharedPtr<Node> &root, Key key, Value data) {
-    if (root.get() == nullptr) {
-        SharedPtr<Node> res(new Node());
-        res->key = key;
-        res->data = data;
-        res->height = 1;
-        return res;
+    thread_local std::vector<PathStep> path;
+    path.clear();
+
+    const Node *node = root.get();
+    while (node != nullptr && !(node->key == key)) {
+        bool toLeft = key < node->key;
+        path.push_back({node, toLeft});
+        node = (toLeft ? node->left : node->right).get();
     }
 
-    SharedPtr<Node> newRoot(new Node());
-    newRoot->key = root->key;
-    newRoot->data = root->data;
-
-    if (root->key == key) {
-        newRoot->left = root->left;
-        newRoot->right = root->right;
-        newRoot->data = data;
-        newRoot->height = root->height;
-        return newRoot;
-    } else if (root->key < key) {
-        newRoot->left = root->left;
-        newRoot->right = upsert(root->right, key, data);
-        newRoot->updateHeight();
-        return balance(newRoot);
-    } else {
-        newRoot->left = upsert(root->left, key, data);
-        newRoot->right = root->right;
-        newRoot->updateHeight();
-        return balance(newRoot);
+    if (node == nullptr)
+        return rebuildPath(path, path.size(), nullptr, makeNode(std::move(key), std::move(data), {}, {}));
+
+    // equal value doesn't allocate anything
+    if (sameValue(node->data, data))
+        return root;
+
+    return rebuildPath(path, path.size(), nullptr, makeNode(std::move(key), std::move(data), node->left, node->right));
+}
+
+template<typename Key, typename Value>
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::remove(const SharedPtr<Node> &root, Key key) {
+    thread_local std::vector<PathStep> path;
+    path.clear();
+
+    const Node *node = root.get();
+    while (node != nullptr && !(node->key == key)) {
+        bool toLeft = key < node->key;
+        path.push_back({node, toLeft});
+        node = (toLeft ? node->left : node->right).get();
     }
+
+    if (node == nullptr)
+        return root;
+    if (node->left.get() == nullptr)
+        return rebuildPath(path, path.size(), nullptr, node->right);
+    if (node->right.get() == nullptr)
+        return rebuildPath(path, path.size(), nullptr, node->left);
+
+    // removed node is replaced by closest key from its higher subtree, path continues down to that key
+    size_t target = path.size();
+    bool toLeft = node->left->height > node->right->height;
+    path.push_back({node, toLeft});
+    const Node *closest = (toLeft ? node->left : node->right).get();
+    while ((toLeft ? closest->right : closest->left).get() != nullptr) {
+        path.push_back({closest, !toLeft});
+        closest = (toLeft ? closest->right : closest->left).get();
+    }
+
+    return rebuildPath(path, target, closest, toLeft ? closest->left : closest->right);
 }
 
+// copies path bottom-up around new child, balancing every copy; node path[replaced] gets key and value of replacement
 template<typename Key, typename Value>
-SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::balance(const SharedPtr<Node> &root) {
+SharedPtr<typename LFMapAvl<Key, Value>::Node>
+LFMapAvl<Key, Value>::rebuildPath(const std::vector<PathStep> &path, size_t replaced, const Node *replacement, SharedPtr<Node> child) {
+    for (size_t i = path.size(); i > 0; i--) {
+        const PathStep &step = path[i - 1];
+        const Node *source = i - 1 == replaced ? replacement : step.node;
+        SharedPtr<Node> node;
+        if (step.toLeft)
+            node = makeNode(source->key, source->data, std::move(child), step.node->right);
+        else
+            node = makeNode(source->key, source->data, step.node->left, std::move(child));
+        child = balance(std::move(node));
+    }
+
+    return child;
+}
+
+template<typename Key, typename Value>
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::balance(SharedPtr<Node> root) {
     int diff = height(root->left) - height(root->right);
     if (abs(diff) < 2)
         return root;
@@ -132,170 +421,151 @@ SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::balance(con
 
     if (diff == 2) {
         if (height(root->left->right) <= height(root->left->left))
-            return rotateRight(root);
+            return rotateRight(std::move(root));
         else
-            return bigRotateRight(root);
+            return bigRotateRight(std::move(root));
     } else {
         if (height(root->right->left) <= height(root->right->right))
-            return rotateLeft(root);
+            return rotateLeft(std::move(root));
         else
-            return bigRotateLeft(root);
+            return bigRotateLeft(std::move(root));
     }
 }
 
+// rotations get fresh unpublished root and reuse it as one of new nodes
 template<typename Key, typename Value>
-SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::rotateLeft(const SharedPtr<Node> &root) {
-    SharedPtr<Node> a(new Node());
-    a->key = root->key;
-    a->data = root->data;
-    a->left = root->left;
-    a->right = root->right->left;
-    a->updateHeight();
-
-    SharedPtr<Node> b(new Node());
-    b->key = root->right->key;
-    b->data = root->right->data;
-    b->left = std::move(a);
-    b->right = root->right->right;
-    b->updateHeight();
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::rotateLeft(SharedPtr<Node> root) {
+    SharedPtr<Node> right = std::move(root->right);
+    root->right = right->left;
+    root->update();
 
-    return b;
+    return makeNode(right->key, right->data, std::move(root), right->right);
 }
 
 template<typename Key, typename Value>
-SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::rotateRight(const SharedPtr<Node> &root) {
-    SharedPtr<Node> a(new Node());
-    a->key = root->key;
-    a->data = root->data;
-    a->left = root->left->right;
-    a->right = root->right;
-    a->updateHeight();
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::rotateRight(SharedPtr<Node> root) {
+    SharedPtr<Node> left = std::move(root->left);
+    root->left = left->right;
+    root->update();
 
-    SharedPtr<Node> b(new Node());
-    b->key = root->left->key;
-    b->data = root->left->data;
-    b->left = root->left->left;
-    b->right = std::move(a);
-    b->updateHeight();
-
-    return b;
+    return makeNode(left->key, left->data, left->left, std::move(root));
 }
 
 template<typename Key, typename Value>
-SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::bigRotateLeft(const SharedPtr<Node> &root) {
-    SharedPtr<Node> a(new Node());
-    a->key = root->key;
-    a->data = root->data;
-    a->left = root->left;
-    a->right = root->right->left->left;
-    a->updateHeight();
-
-    SharedPtr<Node> b(new Node());
-    b->key = root->right->key;
-    b->data = root->right->data;
-    b->left = root->right->left->right;
-    b->right = root->right->right;
-    b->updateHeight();
-
-    SharedPtr<Node> c(new Node());
-    c->key = root->right->left->key;
-    c->data = root->right->left->data;
-    c->left = std::move(a);
-    c->right = std::move(b);
-    c->updateHeight();
-
-    return c;
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::bigRotateLeft(SharedPtr<Node> root) {
+    SharedPtr<Node> right = std::move(root->right);
+    const Node *middle = right->left.get();
+    root->right = middle->left;
+    root->update();
+
+    SharedPtr<Node> b = makeNode(right->key, right->data, middle->right, right->right);
+    return makeNode(middle->key, middle->data, std::move(root), std::move(b));
 }
 
 template<typename Key, typename Value>
-SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::bigRotateRight(const SharedPtr<Node> &root) {
-    SharedPtr<Node> a(new Node());
-    a->key = root->key;
-    a->data = root->data;
-    a->left = root->left->right->right;
-    a->right = root->right;
-    a->updateHeight();
-
-    SharedPtr<Node> b(new Node());
-    b->key = root->left->key;
-    b->data = root->left->data;
-    b->left = root->left->left;
-    b->right = root->left->right->left;
-    b->updateHeight();
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::bigRotateRight(SharedPtr<Node> root) {
+    SharedPtr<Node> left = std::move(root->left);
+    const Node *middle = left->right.get();
+    root->left = middle->right;
+    root->update();
+
+    SharedPtr<Node> b = makeNode(left->key, left->data, left->left, middle->left);
+    return makeNode(middle->key, middle->data, std::move(b), std::move(root));
+}
 
-    SharedPtr<Node> c(new Node());
-    c->key = root->left->right->key;
-    c->data = root->left->right->data;
-    c->left = std::move(b);
-    c->right = std::move(a);
-    c->updateHeight();
+// joins two trees with all keys of left < key < all keys of right, heights may differ arbitrarily
+template<typename Key, typename Value>
+SharedPtr<typename LFMapAvl<Key, Value>::Node>
+LFMapAvl<Key, Value>::join(const SharedPtr<Node> &left, Key key, Value data, const SharedPtr<Node> &right) {
+    if (height(left) > height(right) + 1)
+        return balance(makeNode(left->key, left->data, left->left, join(left->right, key, data, right)));
+    if (height(right) > height(left) + 1)
+        return balance(makeNode(right->key, right->data, join(left, key, data, right->left), right->right));
+
+    return makeNode(key, data, left, right);
+}
 
-    return c;
+template<typename Key, typename Value>
+SharedPtr<typename LFMapAvl<Key, Value>::Node>
+LFMapAvl<Key, Value>::join(const SharedPtr<Node> &left, const SharedPtr<Node> &right) {
+    if (left.get() == nullptr)
+        return right;
+    if (right.get() == nullptr)
+        return left;
+
+    Node *max = left.get();
+    while (max->right.get() != nullptr)
+        max = max->right.get();
+
+    return join(remove(left, max->key), max->key, max->data, right);
 }
 
 template<typename Key, typename Value>
-SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::remove(const SharedPtr<Node> &root, Key key) {
-    if (root.get() == nullptr)
+SharedPtr<typename LFMapAvl<Key, Value>::Node>
+LFMapAvl<Key, Value>::applyBatch(const SharedPtr<Node> &root, BatchIterator first, BatchIterator last) {
+    if (first == last)
         return root;
 
-    if (root->key < key) {
-        auto newRight = remove(root->right, key);
-        if (newRight.get() == root->right.get())
-            return root;
+    if (root.get() == nullptr) {
+        if (std::all_of(first, last, [](const auto &op) { return bool(op.value); }))
+            return build(first, last);
 
-        SharedPtr<Node> newRoot(new Node());
-        newRoot->key = root->key;
-        newRoot->data = root->data;
-        newRoot->left = root->left;
-        newRoot->right = std::move(newRight);
-        newRoot->updateHeight();
-
-        return balance(newRoot);
-    } else if (root->key > key) {
-        auto newLeft = remove(root->left, key);
-        if (newLeft.get() == root->left.get())
-            return root;
+        std::vector<BatchOperation> upserts;
+        std::copy_if(first, last, std::back_inserter(upserts), [](const auto &op) { return bool(op.value); });
+        return build(upserts.cbegin(), upserts.cend());
+    }
 
-        SharedPtr<Node> newRoot(new Node());
-        newRoot->key = root->key;
-        newRoot->data = root->data;
-        newRoot->left = std::move(newLeft);
-        newRoot->right = root->right;
-        newRoot->updateHeight();
+    auto less = std::lower_bound(first, last, root->key, [](const auto &op, const Key &key) { return op.key < key; });
+    auto greater = less;
+    if (greater != last && greater->key == root->key)
+        greater++;
 
-        return balance(newRoot);
+    auto newLeft = applyBatch(root->left, first, less);
+    auto newRight = applyBatch(root->right, greater, last);
+
+    if (less == greater || (less->value && sameValue(*less->value, root->data))) {
+        if (newLeft.get() == root->left.get() && newRight.get() == root->right.get())
+            return root;
+        return join(newLeft, root->key, root->data, newRight);
+    } else if (less->value) {
+        return join(newLeft, root->key, *less->value, newRight);
     } else {
-        Node *targetLeft = root->left.get();
-        Node *targetRight = root->right.get();
-        if (targetLeft == nullptr && targetRight == nullptr)
-            return {};
+        return join(newLeft, newRight);
+    }
+}
 
-        if (targetRight == nullptr || (targetLeft && targetLeft->height > targetRight->height)) {
-            while (targetLeft->right.get() != nullptr)
-                targetLeft = targetLeft->right.get();
-
-            SharedPtr<Node> newRoot(new Node());
-            newRoot->key = targetLeft->key;
-            newRoot->data = targetLeft->data;
-            newRoot->left = remove(root->left, targetLeft->key);
-            newRoot->right = root->right;
-            newRoot->updateHeight();
-
-            return balance(newRoot);
-        } else {
-            while (targetRight->left.get() != nullptr)
-                targetRight = targetRight->left.get();
-
-            SharedPtr<Node> newRoot(new Node());
-            newRoot->key = targetRight->key;
-            newRoot->data = targetRight->data;
-            newRoot->left = root->left;
-            newRoot->right = remove(root->right, targetRight->key);
-            newRoot->updateHeight();
-
-            return balance(newRoot);
-        }
+template<typename Key, typename Value>
+SharedPtr<typename LFMapAvl<Key, Value>::Node> LFMapAvl<Key, Value>::build(BatchIterator first, BatchIterator last) {
+    auto read = [first](size_t index, Key &key, Value &value) {
+        key = first[index].key;
+        value = *first[index].value;
+    };
+    return build(read, 0, last - first);
+}
+
+// perfectly balanced tree in O(n)
+template<typename Key, typename Value>
+template<typename Reader>
+SharedPtr<typename LFMapAvl<Key, Value>::Node>
+LFMapAvl<Key, Value>::build(const Reader &read, size_t first, size_t last, size_t threadCount) {
+    if (first == last)
+        return {};
+
+    size_t middle = first + (last - first) / 2;
+    SharedPtr<Node> node(new Node());
+    read(middle, node->key, node->data);
+    if (threadCount > 1 && last - first >= PARALLEL_BUILD_THRESHOLD) {
+        std::thread leftBuilder([&]() {
+            node->left = build(read, first, middle, threadCount / 2);
+        });
+        node->right = build(read, middle + 1, last, threadCount - threadCount / 2);
+        leftBuilder.join();
+    } else {
+        node->left = build(read, first, middle);
+        node->right = build(read, middle + 1, last);
     }
+    node->update();
+    return node;
 }
 
 } // namespace LFStructs
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace LFStructs {
+
+template<typename T, typename = void>
+struct IsEqualityComparable : std::false_type {};
+template<typename T>
+struct IsEqualityComparable<T, std::void_t<decltype(std::declval<const T&>() == std::declval<const T&>())>> : std::true_type {};
+
+/* Lets writers skip path copy and root CAS when value doesn't change.
+ * Values without operator== are never considered same. */
+template<typename T>
+bool sameValue(const T &a, const T &b) {
+    if constexpr (IsEqualityComparable<T>::value)
+        return a == b;
+    else
+        return false;
+}
+
+/* One write of a batch applied by LFMap::applyBatch / LFMapAvl::applyBatch.
+ * Empty value means remove. */
+template<typename Key, typename Value>
+struct MapBatchOperation {
+    Key key;
+    std::optional<Value> value;
+
+    static MapBatchOperation upsert(Key key, Value value) { return {key, value}; }
+    static MapBatchOperation remove(Key key) { return {key, {}}; }
+};
+
+/* Sorts batch by key (if caller did not) and leaves only the last write
+ * for every key, so one tree pass can apply at most one write per node. */
+template<typename Key, typename Value>
+std::vector<MapBatchOperation<Key, Value>> normalizeBatch(std::vector<MapBatchOperation<Key, Value>> ops) {
+    auto keyLess = [](const auto &a, const auto &b) { return a.key < b.key; };
+    if (!std::is_sorted(ops.begin(), ops.end(), keyLess))
+        std::stable_sort(ops.begin(), ops.end(), keyLess);
+
+    size_t count = 0;
+    for (size_t i = 0; i < ops.size(); i++) {
+        if (count > 0 && !(ops[count - 1].key < ops[i].key))
+            ops[count - 1] = std::move(ops[i]);
+        else if (count++ != i)
+            ops[count - 1] = std::move(ops[i]);
+    }
+    ops.erase(ops.begin() + count, ops.end());
+
+    return ops;
+}
+
+// selects constructor which builds map from sorted range at once
+struct BulkLoadTag {};
+inline constexpr BulkLoadTag bulkLoad{};
+
+// bulk builds split ranges between threads only while they are at least this long
+const size_t PARALLEL_BUILD_THRESHOLD = 1 << 16;
+
+/* Calls build(count, read), where read(i, key, value) copies key and value of
+ * i-th pair of [begin, end). Ranges without random access are copied first. */
+template<typename Key, typename Value, typename Iterator, typename Build>
+auto buildFromRange(Iterator begin, Iterator end, const Build &build) {
+    using Category = typename std::iterator_traits<Iterator>::iterator_category;
+    if constexpr (std::is_base_of_v<std::random_access_iterator_tag, Category>) {
+        return build(size_t(end - begin), [begin](size_t index, Key &key, Value &value) {
+            const auto &entry = begin[index];
+            key = entry.first;
+            value = entry.second;
+        });
+    } else {
+        std::vector<std::pair<Key, Value>> entries(begin, end);
+        return buildFromRange<Key, Value>(entries.cbegin(), entries.cend(), build);
+    }
+}
+
+} // namespace LFStructs
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace LFStructs {
+
+/* Snapshot file written by saveSnapshot of tree maps: header followed by
+ * `count` entries sorted by key, every entry is raw key bytes and then raw
+ * value bytes without any padding. Only trivially copyable types are supported,
+ * file is not portable between platforms with different layout of them. */
+struct SnapshotFileHeader {
+    char magic[8];
+    uint32_t keySize;
+    uint32_t valueSize;
+    uint64_t count;
+};
+
+const char SNAPSHOT_FILE_MAGIC[8] = {'L', 'F', 'M', 'A', 'P', 'S', 'N', '1'};
+
+// streams snapshot in sorted order to temporary file and renames it to path, so path is never half-written
+template<typename Key, typename Value, typename Snapshot>
+bool writeSnapshotFile(const Snapshot &snapshot, const std::string &path) {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "snapshot files support only trivially copyable keys and values");
+
+    std::string tmpPath = path + ".tmp";
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    static const size_t BUFFER_SIZE = 1 << 20;
+    setvbuf(file, nullptr, _IOFBF, BUFFER_SIZE);
+
+    SnapshotFileHeader header;
+    memcpy(header.magic, SNAPSHOT_FILE_MAGIC, sizeof(header.magic));
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.count = snapshot.size();
+
+    bool good = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (auto it = snapshot.begin(); good && it != snapshot.end(); ++it)
+        good = fwrite(&it.key(), sizeof(Key), 1, file) == 1 && fwrite(&it.value(), sizeof(Value), 1, file) == 1;
+
+    good = fclose(file) == 0 && good;
+    if (good && rename(tmpPath.c_str(), path.c_str()) == 0)
+        return true;
+
+    unlink(tmpPath.c_str());
+    return false;
+}
+
+// read-only mapping of snapshot file, valid() is false if file is missing or doesn't match Key/Value
+template<typename Key, typename Value>
+class MappedSnapshotFile {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "snapshot files support only trivially copyable keys and values");
+
+public:
+    explicit MappedSnapshotFile(const std::string &path);
+    ~MappedSnapshotFile();
+
+    MappedSnapshotFile(const MappedSnapshotFile &other) = delete;
+    MappedSnapshotFile& operator=(const MappedSnapshotFile &other) = delete;
+
+    bool valid() const { return entries != nullptr; }
+    size_t size() const { return count; }
+
+    // entries are not aligned inside file, so they are copied out byte-wise
+    void read(size_t index, Key &key, Value &value) const {
+        const char *entry = entries + index * ENTRY_SIZE;
+        memcpy(&key, entry, sizeof(Key));
+        memcpy(&value, entry + sizeof(Key), sizeof(Value));
+    }
+
+private:
+    static const size_t ENTRY_SIZE = sizeof(Key) + sizeof(Value);
+
+    void *mapping = MAP_FAILED;
+    size_t mappingSize = 0;
+    const char *entries = nullptr;
+    size_t count = 0;
+};
+
+template<typename Key, typename Value>
+MappedSnapshotFile<Key, Value>::MappedSnapshotFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(SnapshotFileHeader)) {
+        mappingSize = info.st_size;
+        mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return;
+
+    // whole file is read right after mapping
+    madvise(mapping, mappingSize, MADV_WILLNEED);
+
+    SnapshotFileHeader header;
+    memcpy(&header, mapping, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.keySize != sizeof(Key) || header.valueSize != sizeof(Value) ||
+            header.count > (mappingSize - sizeof(header)) / ENTRY_SIZE)
+        return;
+
+    count = header.count;
+    entries = static_cast<const char*>(mapping) + sizeof(header);
+}
+
+template<typename Key, typename Value>
+MappedSnapshotFile<Key, Value>::~MappedSnapshotFile() {
+    if (mapping != MAP_FAILED)
+        munmap(mapping, mappingSize);
+}
+
+} // namespace LFStructs
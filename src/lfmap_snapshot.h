@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+
+namespace LFStructs {
+
+/* Order statistics over a persistent tree whose nodes keep subtree size.
+ * All of them take O(height) and should be called on a pinned root. */
+template<typename Node>
+int subtreeSize(const Node *node) {
+    return node == nullptr ? 0 : node->size;
+}
+
+// number of keys less than given one
+template<typename Node, typename Key>
+size_t subtreeRank(const Node *node, const Key &key) {
+    size_t rank = 0;
+    while (node != nullptr) {
+        if (node->key < key) {
+            rank += subtreeSize(node->left.get()) + 1;
+            node = node->right.get();
+        } else {
+            node = node->left.get();
+        }
+    }
+
+    return rank;
+}
+
+// node with k-th smallest key (0-based)
+template<typename Node>
+const Node* subtreeSelect(const Node *node, size_t k) {
+    while (node != nullptr) {
+        size_t leftSize = subtreeSize(node->left.get());
+        if (k < leftSize) {
+            node = node->left.get();
+        } else if (k == leftSize) {
+            return node;
+        } else {
+            k -= leftSize + 1;
+            node = node->right.get();
+        }
+    }
+
+    return nullptr;
+}
+
+// resolves keys[order[first..last)] sorted by key, part of the tree above several keys is walked once
+template<typename Node, typename Key, typename Value>
+void subtreeMultiGet(const Node *node, const std::vector<Key> &keys, const size_t *first, const size_t *last,
+                     std::vector<std::optional<Value>> &out) {
+    while (node != nullptr && first != last) {
+        const size_t *less = std::partition_point(first, last, [&](size_t i) { return keys[i] < node->key; });
+        const size_t *greater = std::partition_point(less, last, [&](size_t i) { return !(node->key < keys[i]); });
+        for (const size_t *it = less; it != greater; it++)
+            out[*it] = node->data;
+
+        subtreeMultiGet(node->left.get(), keys, first, less, out);
+        node = node->right.get();
+        first = greater;
+    }
+}
+
+// out[i] is value of keys[i], keys may go in any order and repeat
+template<typename Node, typename Key, typename Value>
+void subtreeMultiGet(const Node *root, const std::vector<Key> &keys, std::vector<std::optional<Value>> &out) {
+    out.assign(keys.size(), std::nullopt);
+
+    thread_local std::vector<size_t> order;
+    order.resize(keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    if (!std::is_sorted(keys.begin(), keys.end()))
+        std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    subtreeMultiGet(root, keys, order.data(), order.data() + order.size(), out);
+}
+
+/* Immutable point-in-time view of a persistent map.
+ *
+ * Both LFMap and LFMapAvl never modify published nodes, so holding a root
+ * SharedPtr is enough to keep the whole version alive. Taking a snapshot is a
+ * single AtomicSharedPtr::get(), everything else runs without touching
+ * shared atomics.
+ *
+ * Node should have left/right SharedPtr children, key and data fields.
+ * Order statistics also require subtree size field. */
+template<typename Node, typename Key, typename Value>
+class MapSnapshot {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const Key&, const Value&>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        Iterator() = default;
+
+        value_type operator*() const { return {path.back()->key, path.back()->data}; }
+        const Key& key() const { return path.back()->key; }
+        const Value& value() const { return path.back()->data; }
+
+        Iterator& operator++() {
+            Node *node = path.back();
+            path.pop_back();
+            pushLeftmost(node->right.get());
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const Iterator &other) const {
+            return current() == other.current();
+        }
+        bool operator!=(const Iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        Node* current() const { return path.empty() ? nullptr : path.back(); }
+        void pushLeftmost(Node *node) {
+            while (node != nullptr) {
+                path.push_back(node);
+                node = node->left.get();
+            }
+        }
+
+        // nodes still to be visited, current node at the back
+        std::vector<Node*> path;
+
+        friend class MapSnapshot;
+    };
+
+    class Range {
+    public:
+        Iterator begin() const { return first; }
+        Iterator end() const { return last; }
+
+    private:
+        Range(Iterator first, Iterator last): first(std::move(first)), last(std::move(last)) {}
+
+        Iterator first;
+        Iterator last;
+
+        friend class MapSnapshot;
+    };
+
+    MapSnapshot() = default;
+    explicit MapSnapshot(SharedPtr<Node> root): root(std::move(root)) {}
+
+    bool empty() const { return root.get() == nullptr; }
+    std::optional<Value> get(const Key &key) const;
+    void multiGet(const std::vector<Key> &keys, std::vector<std::optional<Value>> &out) const {
+        subtreeMultiGet(root.get(), keys, out);
+    }
+
+    size_t size() const { return subtreeSize(root.get()); }
+    size_t rank(const Key &key) const { return subtreeRank(root.get(), key); }
+    std::optional<std::pair<Key, Value>> select(size_t k) const;
+    size_t countRange(const Key &lo, const Key &hi) const;
+
+    Iterator begin() const;
+    Iterator end() const { return {}; }
+
+    // first element with key >= given one
+    Iterator lowerBound(const Key &key) const;
+    // first element with key > given one
+    Iterator upperBound(const Key &key) const;
+    // elements with lo <= key < hi
+    Range range(const Key &lo, const Key &hi) const;
+
+private:
+    SharedPtr<Node> root;
+};
+
+/* Lookups through one pinned version of a map. Unlike map get(), which pins
+ * the root for every call, session touches root AtomicSharedPtr only on
+ * creation and refresh(), so many lookups cost one contended round-trip. */
+template<typename Map>
+class MapReadSession {
+    using Key = typename Map::key_type;
+    using Value = typename Map::mapped_type;
+
+public:
+    explicit MapReadSession(Map &map): map(&map), current(map.snapshot()) {}
+
+    std::optional<Value> get(const Key &key) const { return current.get(key); }
+    void multiGet(const std::vector<Key> &keys, std::vector<std::optional<Value>> &out) const {
+        current.multiGet(keys, out);
+    }
+    const typename Map::Snapshot& snapshot() const { return current; }
+
+    // moves session to the latest version
+    void refresh() { current = map->snapshot(); }
+
+private:
+    Map *map;
+    typename Map::Snapshot current;
+};
+
+template<typename Node, typename Key, typename Value>
+std::optional<Value> MapSnapshot<Node, Key, Value>::get(const Key &key) const {
+    Node *node = root.get();
+    while (node != nullptr) {
+        if (node->key < key)
+            node = node->right.get();
+        else if (key < node->key)
+            node = node->left.get();
+        else
+            return node->data;
+    }
+
+    return {};
+}
+
+template<typename Node, typename Key, typename Value>
+std::optional<std::pair<Key, Value>> MapSnapshot<Node, Key, Value>::select(size_t k) const {
+    const Node *node = subtreeSelect(root.get(), k);
+    if (node == nullptr)
+        return {};
+
+    return std::make_pair(node->key, node->data);
+}
+
+template<typename Node, typename Key, typename Value>
+size_t MapSnapshot<Node, Key, Value>::countRange(const Key &lo, const Key &hi) const {
+    if (!(lo < hi))
+        return 0;
+
+    return subtreeRank(root.get(), hi) - subtreeRank(root.get(), lo);
+}
+
+template<typename Node, typename Key, typename Value>
+typename MapSnapshot<Node, Key, Value>::Iterator MapSnapshot<Node, Key, Value>::begin() const {
+    Iterator it;
+    it.pushLeftmost(root.get());
+    return it;
+}
+
+template<typename Node, typename Key, typename Value>
+typename MapSnapshot<Node, Key, Value>::Iterator MapSnapshot<Node, Key, Value>::lowerBound(const Key &key) const {
+    Iterator it;
+    Node *node = root.get();
+    while (node != nullptr) {
+        if (node->key < key) {
+            node = node->right.get();
+        } else {
+            it.path.push_back(node);
+            node = node->left.get();
+        }
+    }
+
+    return it;
+}
+
+template<typename Node, typename Key, typename Value>
+typename MapSnapshot<Node, Key, Value>::Iterator MapSnapshot<Node, Key, Value>::upperBound(const Key &key) const {
+    Iterator it;
+    Node *node = root.get();
+    while (node != nullptr) {
+        if (!(key < node->key)) {
+            node = node->right.get();
+        } else {
+            it.path.push_back(node);
+            node = node->left.get();
+        }
+    }
+
+    return it;
+}
+
+template<typename Node, typename Key, typename Value>
+typename MapSnapshot<Node, Key, Value>::Range MapSnapshot<Node, Key, Value>::range(const Key &lo, const Key &hi) const {
+    if (!(lo < hi))
+        return Range(end(), end());
+
+    return Range(lowerBound(lo), lowerBound(hi));
+}
+
+} // namespace LFStructs
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <thread>
+#include <utility>
+
+#include "atomic_shared_ptr.h"
+
+namespace LFStructs {
+
+/* Min-priority queue built on persistent leftist heaps.
+ *
+ * Every heap is published through one AtomicSharedPtr root, so push and popMin
+ * are a path copy along the right spine (O(log n) nodes) and a root CAS.
+ *
+ * With heapCount == 1 the queue is strict: popMin always returns the smallest
+ * priority present at the linearization point. With heapCount > 1 the queue
+ * works as a MultiQueue: push goes to a random heap, popMin looks at two random
+ * heaps and pops the smaller top. This trades strict ordering for scalability -
+ * popped element is expected to be among the O(heapCount) smallest ones. */
+template<typename Priority, typename T>
+class LFPriorityQueue {
+    struct Node {
+        SharedPtr<Node> left;
+        SharedPtr<Node> right;
+
+        Priority priority;
+        T data;
+        int rank;
+
+        void updateRank() {
+            if (LFPriorityQueue::rank(left) < LFPriorityQueue::rank(right))
+                std::swap(left, right);
+            rank = LFPriorityQueue::rank(right) + 1;
+        }
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Heap {
+        AtomicSharedPtr<Node> root;
+    };
+
+public:
+    LFPriorityQueue(): LFPriorityQueue(1) {}
+    explicit LFPriorityQueue(size_t heapCount);
+
+    void push(Priority priority, const T &data);
+    std::optional<std::pair<Priority, T>> popMin();
+
+    bool relaxed() const { return heapCount > 1; }
+    // exact when no push/popMin is in progress
+    size_t approxSize() const { return std::max(counter.load(), 0LL); }
+
+private:
+    static int rank(const SharedPtr<Node> &node);
+    static SharedPtr<Node> merge(const SharedPtr<Node> &a, const SharedPtr<Node> &b);
+
+    std::optional<std::pair<Priority, T>> popMin(AtomicSharedPtr<Node> &heap);
+    size_t randomHeap();
+
+    size_t heapCount;
+    std::unique_ptr<Heap[]> heaps;
+    StripedCounter counter;
+};
+
+template<typename Priority, typename T>
+LFPriorityQueue<Priority, T>::LFPriorityQueue(size_t heapCount)
+    : heapCount(std::max<size_t>(heapCount, 1))
+    , heaps(new Heap[this->heapCount])
+{}
+
+template<typename Priority, typename T>
+int LFPriorityQueue<Priority, T>::rank(const SharedPtr<Node> &node) {
+    if (node.get() == nullptr)
+        return 0;
+    else
+        return node->rank;
+}
+
+template<typename Priority, typename T>
+SharedPtr<typename LFPriorityQueue<Priority, T>::Node>
+LFPriorityQueue<Priority, T>::merge(const SharedPtr<Node> &a, const SharedPtr<Node> &b) {
+    if (a.get() == nullptr)
+        return b;
+    if (b.get() == nullptr)
+        return a;
+    if (b->priority < a->priority)
+        return merge(b, a);
+
+    SharedPtr<Node> root(new Node());
+    root->priority = a->priority;
+    root->data = a->data;
+    root->left = a->left;
+    root->right = merge(a->right, b);
+    root->updateRank();
+
+    return root;
+}
+
+template<typename Priority, typename T>
+size_t LFPriorityQueue<Priority, T>::randomHeap() {
+    thread_local std::minstd_rand generator(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    return generator() % heapCount;
+}
+
+template<typename Priority, typename T>
+void LFPriorityQueue<Priority, T>::push(Priority priority, const T &data) {
+    LATENCY_SCOPE(LatencyOp::Push);
+    FAST_LOG(Operation::Push, 0);
+    SharedPtr<Node> node(new Node());
+    node->priority = priority;
+    node->data = data;
+    node->rank = 1;
+
+    AtomicSharedPtr<Node> &heap = heaps[heapCount == 1 ? 0 : randomHeap()].root;
+    while (true) {
+        SharedPtr<Node> root = heap.get();
+        SharedPtr<Node> newRoot = merge(root, node);
+        if (heap.compareExchange(root.get(), std::move(newRoot))) {
+            counter.add(1);
+            return;
+        }
+    }
+}
+
+template<typename Priority, typename T>
+std::optional<std::pair<Priority, T>> LFPriorityQueue<Priority, T>::popMin(AtomicSharedPtr<Node> &heap) {
+    while (true) {
+        SharedPtr<Node> root = heap.get();
+        if (root.get() == nullptr)
+            return {};
+
+        SharedPtr<Node> newRoot = merge(root->left, root->right);
+        if (heap.compareExchange(root.get(), std::move(newRoot))) {
+            counter.add(-1);
+            return std::make_pair(root->priority, root->data);
+        }
+    }
+}
+
+template<typename Priority, typename T>
+std::optional<std::pair<Priority, T>> LFPriorityQueue<Priority, T>::popMin() {
+    LATENCY_SCOPE(LatencyOp::Pop);
+    FAST_LOG(Operation::Pop, 0);
+    if (heapCount == 1)
+        return popMin(heaps[0].root);
+
+    // two random choices, the heap with smaller top wins
+    size_t first = randomHeap();
+    size_t second = randomHeap();
+    {
+        FastSharedPtr<Node> firstTop = heaps[first].root.getFast();
+        FastSharedPtr<Node> secondTop = heaps[second].root.getFast();
+        if (firstTop.get() == nullptr ||
+                (secondTop.get() != nullptr && secondTop->priority < firstTop->priority))
+            std::swap(first, second);
+    }
+    if (auto res = popMin(heaps[first].root))
+        return res;
+
+    // chosen heaps were empty, don't report empty queue while other heaps still have work
+    for (size_t i = 0; i < heapCount; i++)
+        if (auto res = popMin(heaps[(first + i) % heapCount].root))
+            return res;
+
+    return {};
+}
+
+} // namespace LFStructs
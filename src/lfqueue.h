@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <optional>
+
 #include "atomic_shared_ptr.h"
 
 namespace LFStructs {
@@ -18,9 +21,13 @@ public:
     void push(const T &data);
     std::optional<T> pop();
 
+    // exact when no push/pop is in progress
+    size_t approxSize() const { return std::max(counter.load(), 0LL); }
+
 private:
-    AtomicSharedPtr<Node> front;
-    AtomicSharedPtr<Node> back;
+    alignas(CACHE_LINE_SIZE) AtomicSharedPtr<Node> front;
+    alignas(CACHE_LINE_SIZE) AtomicSharedPtr<Node> back;
+    StripedCounter counter;
 };
 
 template<typename T>
@@ -35,6 +42,7 @@ LFQueue<T>::LFQueue() {
 
 template<typename T>
 void LFQueue<T>::push(const T &data) {
+    LATENCY_SCOPE(LatencyOp::Push);
     FAST_LOG(Operation::Push, data);
     auto newBack = SharedPtr(new Node{
                                  .data = data
@@ -43,6 +51,7 @@ void LFQueue<T>::push(const T &data) {
     while (true) {
         FastSharedPtr<Node> currentBack = back.getFast();
         if (currentBack.get()->next.compareExchange(nullptr, newBack.copy())) {
+            counter.add(1);
             back.compareExchange(currentBack.get(), std::move(newBack));
             return;
         } else {
@@ -55,6 +64,7 @@ void LFQueue<T>::push(const T &data) {
 
 template<typename T>
 std::optional<T> LFQueue<T>::pop() {
+    LATENCY_SCOPE(LatencyOp::Pop);
     FAST_LOG(Operation::Pop, 0);
     FastSharedPtr<Node> res = front.getFast();
     while (res.get()->consumed.test_and_set()) {
@@ -66,6 +76,7 @@ std::optional<T> LFQueue<T>::pop() {
         res = front.getFast();
     }
 
+    counter.add(-1);
     return { res.get()->data };
 }
 
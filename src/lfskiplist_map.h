@@ -0,0 +1,363 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <thread>
+#include <utility>
+
+#include "atomic_shared_ptr.h"
+
+namespace LFStructs {
+
+/* Ordered map with LFMap API built as a lock-free skip list.
+ *
+ * Unlike persistent trees there is no root to CAS: writers change only `next`
+ * link of the node preceding their key (or value slot of existing node), so
+ * writers to different keys proceed in parallel.
+ *
+ * Removal follows Harris/Fraser scheme with marker nodes instead of pointer
+ * tag bits, which AtomicSharedPtr doesn't have: value slot is cleared first,
+ * then `next` of removed node is replaced with a marker node pointing to old
+ * successor, which freezes it, since nobody inserts after a marker. After that
+ * predecessor link is swung over both of them by whoever gets there first.
+ *
+ * Index levels are towers of Index nodes pointing down to base nodes. They
+ * are only hints for search: index of removed node is unlinked lazily by
+ * traversals, and index lost in a race just makes search a bit longer.
+ *
+ * Key should be default constructible, head node has Key(). */
+template<typename Key, typename Value>
+class LFSkipListMap {
+    struct Node {
+        Node(const Key &key, Value *value, bool marker = false)
+            : key(key)
+            , value(value)
+            , marker(marker)
+        {}
+
+        Key key;
+        // nullptr once key is removed, nullptr in head and markers
+        AtomicSharedPtr<Value> value;
+        AtomicSharedPtr<Node> next;
+        // set by whoever sees cleared value, lets traversals skip node without touching value
+        std::atomic<bool> removed = false;
+        const bool marker;
+    };
+
+    struct Index {
+        Index(SharedPtr<Node> node, SharedPtr<Index> down)
+            : key(node->key)
+            , node(std::move(node))
+            , down(std::move(down))
+        {}
+
+        // copy of node key, saves a cache miss for every index passed by
+        Key key;
+        SharedPtr<Node> node;
+        // nullptr at lowest index level, which leads to `node` itself
+        SharedPtr<Index> down;
+        AtomicSharedPtr<Index> right;
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+
+    /* Weakly consistent iterator: keys are visited in increasing order, every
+     * key present for the whole iteration is visited once, keys changed
+     * concurrently may be visited or not. Current node and value are pinned, so
+     * dereferenced pair stays valid until iterator moves. */
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const Key&, const Value&>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        Iterator() = default;
+
+        value_type operator*() const { return {node->key, *current.get()}; }
+        const Key& key() const { return node->key; }
+        const Value& value() const { return *current.get(); }
+
+        Iterator& operator++() {
+            node = node->next.get();
+            skipRemoved();
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const Iterator &other) const {
+            return node.get() == other.node.get();
+        }
+        bool operator!=(const Iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        explicit Iterator(SharedPtr<Node> first): node(std::move(first)) { skipRemoved(); }
+
+        void skipRemoved() {
+            // links of removed nodes are frozen and still lead forward
+            while (node.get() != nullptr) {
+                if (!node->marker) {
+                    current = node->value.get();
+                    if (current.get() != nullptr)
+                        return;
+                }
+                node = node->next.get();
+            }
+            current = SharedPtr<Value>();
+        }
+
+        SharedPtr<Node> node;
+        SharedPtr<Value> current;
+
+        friend class LFSkipListMap;
+    };
+
+    LFSkipListMap();
+
+    void upsert(Key key, Value value);
+    std::optional<Value> get(Key key);
+    void remove(Key key);
+
+    // exact when no write is in progress
+    size_t approxSize() const { return std::max(counter.load(), 0LL); }
+
+    Iterator begin() { return Iterator(head->next.get()); }
+    Iterator end() { return {}; }
+    // first element with key >= given one
+    Iterator lowerBound(const Key &key);
+
+private:
+    // index levels above base list, enough for 4^16 keys
+    static const int MAX_LEVEL = 16;
+
+    static int randomHeight();
+
+    // index at given level after which key belongs, `right` (if given) gets its successor there
+    SharedPtr<Index> findIndex(const Key &key, int level, SharedPtr<Index> *right = nullptr);
+    /* `before` gets last node with key less than given one, `node` gets its
+     * successor: first node with key >= given one or nullptr. Removed nodes
+     * met on the way are unlinked. */
+    void findNode(const Key &key, SharedPtr<Node> &before, SharedPtr<Node> &node);
+    // node is removed, successor is its current next
+    static void helpUnlink(const SharedPtr<Node> &before, const SharedPtr<Node> &node, const SharedPtr<Node> &successor);
+    void addIndexes(const SharedPtr<Node> &node, int height);
+
+    SharedPtr<Node> head;
+    SharedPtr<Index> heads[MAX_LEVEL];
+    // index levels in use, searches start from heads[levels - 1]
+    alignas(CACHE_LINE_SIZE) std::atomic<int> levels;
+    StripedCounter counter;
+};
+
+template<typename Key, typename Value>
+LFSkipListMap<Key, Value>::LFSkipListMap()
+    : head(new Node(Key(), nullptr))
+    , levels(1)
+{
+    for (int level = 0; level < MAX_LEVEL; level++)
+        heads[level] = SharedPtr<Index>(new Index(head, level == 0 ? SharedPtr<Index>() : heads[level - 1]));
+}
+
+template<typename Key, typename Value>
+int LFSkipListMap<Key, Value>::randomHeight() {
+    // glibc rand() takes global lock, every thread gets its own generator instead
+    thread_local std::minstd_rand generator(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    // every next level gets a quarter of keys of previous one
+    unsigned bits = generator();
+    int height = 0;
+    while ((bits & 3) == 0 && height < MAX_LEVEL) {
+        height++;
+        bits >>= 2;
+    }
+
+    return height;
+}
+
+template<typename Key, typename Value>
+SharedPtr<typename LFSkipListMap<Key, Value>::Index>
+LFSkipListMap<Key, Value>::findIndex(const Key &key, int level, SharedPtr<Index> *right) {
+    int current = std::max(levels.load(), level + 1) - 1;
+    SharedPtr<Index> index = heads[current];
+    while (true) {
+        // successors are peeked with getFast(), only ones search moves to are pinned
+        SharedPtr<Index> advanced;
+        {
+            FastSharedPtr<Index> next = index->right.getFast();
+            if (next.get() != nullptr && !(key < next->key)) {
+                if (next->node->removed.load()) {
+                    // lost race only leaves it for next traversal
+                    index->right.compareExchange(next.get(), next->right.get());
+                    continue;
+                }
+                if (next->key < key)
+                    advanced = next.toShared();
+            }
+
+            if (advanced.get() == nullptr && current == level) {
+                if (right != nullptr)
+                    *right = next.toShared();
+                return index;
+            }
+        }
+
+        // FastSharedPtr above should be released before index it was read from
+        if (advanced.get() != nullptr) {
+            index = std::move(advanced);
+        } else {
+            index = index->down;
+            current--;
+        }
+    }
+}
+
+template<typename Key, typename Value>
+void LFSkipListMap<Key, Value>::findNode(const Key &key, SharedPtr<Node> &before, SharedPtr<Node> &node) {
+    while (true) {
+        before = findIndex(key, 0)->node;
+        node = before->next.get();
+        while (node.get() != nullptr) {
+            // `before` was removed and its link frozen, start over
+            if (node->marker)
+                break;
+            if (node->removed.load()) {
+                helpUnlink(before, node, node->next.get());
+                break;
+            }
+            if (!(node->key < key))
+                return;
+
+            before = std::move(node);
+            node = before->next.get();
+        }
+
+        if (node.get() == nullptr)
+            return;
+    }
+}
+
+template<typename Key, typename Value>
+void LFSkipListMap<Key, Value>::helpUnlink(const SharedPtr<Node> &before, const SharedPtr<Node> &node,
+                                           const SharedPtr<Node> &successor) {
+    if (successor.get() == nullptr || !successor->marker) {
+        SharedPtr<Node> marker(new Node(node->key, nullptr, true));
+        marker->next.store(SharedPtr<Node>(successor));
+        node->next.compareExchange(successor.get(), std::move(marker));
+    } else {
+        before->next.compareExchange(node.get(), successor->next.get());
+    }
+}
+
+template<typename Key, typename Value>
+std::optional<Value> LFSkipListMap<Key, Value>::get(Key key) {
+    LATENCY_SCOPE(LatencyOp::Get);
+    SharedPtr<Node> before;
+    SharedPtr<Node> node;
+    findNode(key, before, node);
+    if (node.get() == nullptr || key < node->key)
+        return {};
+
+    FastSharedPtr<Value> value = node->value.getFast();
+    if (value.get() == nullptr)
+        return {};
+    return *value.get();
+}
+
+template<typename Key, typename Value>
+void LFSkipListMap<Key, Value>::upsert(Key key, Value value) {
+    LATENCY_SCOPE(LatencyOp::Upsert);
+    SharedPtr<Node> before;
+    SharedPtr<Node> node;
+    while (true) {
+        findNode(key, before, node);
+        if (node.get() != nullptr && !(key < node->key)) {
+            FastSharedPtr<Value> current = node->value.getFast();
+            if (current.get() == nullptr) {
+                // remover may be preempted before setting the flag, so help it
+                node->removed.store(true);
+                continue;
+            }
+            if (node->value.compareExchange(current.get(), SharedPtr<Value>(new Value(value))))
+                return;
+            continue;
+        }
+
+        SharedPtr<Node> inserted(new Node(key, new Value(value)));
+        inserted->next.store(SharedPtr<Node>(node));
+        if (before->next.compareExchange(node.get(), SharedPtr<Node>(inserted))) {
+            counter.add(1);
+            addIndexes(inserted, randomHeight());
+            return;
+        }
+    }
+}
+
+template<typename Key, typename Value>
+void LFSkipListMap<Key, Value>::remove(Key key) {
+    LATENCY_SCOPE(LatencyOp::Remove);
+    SharedPtr<Node> before;
+    SharedPtr<Node> node;
+    while (true) {
+        findNode(key, before, node);
+        if (node.get() == nullptr || key < node->key)
+            return;
+
+        FastSharedPtr<Value> current = node->value.getFast();
+        if (current.get() == nullptr) {
+            node->removed.store(true);
+            continue;
+        }
+        if (node->value.compareExchange(current.get(), SharedPtr<Value>()))
+            break;
+    }
+
+    node->removed.store(true);
+    counter.add(-1);
+    // second pass marks and unlinks node and its indexes
+    findNode(key, before, node);
+}
+
+template<typename Key, typename Value>
+void LFSkipListMap<Key, Value>::addIndexes(const SharedPtr<Node> &node, int height) {
+    int top = levels.load();
+    while (top < height && !levels.compare_exchange_weak(top, height)) {}
+
+    SharedPtr<Index> down;
+    for (int level = 0; level < height; level++) {
+        SharedPtr<Index> index(new Index(node, down));
+        while (true) {
+            // indexes of removed node would be unlinked right away
+            if (node->removed.load())
+                return;
+
+            SharedPtr<Index> right;
+            SharedPtr<Index> before = findIndex(node->key, level, &right);
+            index->right.store(SharedPtr<Index>(right));
+            if (before->right.compareExchange(right.get(), SharedPtr<Index>(index)))
+                break;
+        }
+        down = std::move(index);
+    }
+}
+
+template<typename Key, typename Value>
+typename LFSkipListMap<Key, Value>::Iterator LFSkipListMap<Key, Value>::lowerBound(const Key &key) {
+    SharedPtr<Node> before;
+    SharedPtr<Node> node;
+    findNode(key, before, node);
+    return Iterator(std::move(node));
+}
+
+} // namespace LFStructs
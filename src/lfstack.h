@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <memory>
 #include <optional>
 
@@ -20,12 +21,17 @@ public:
     void push(const T &data);
     std::optional<T> pop();
 
+    // exact when no push/pop is in progress
+    size_t approxSize() const { return std::max(counter.load(), 0LL); }
+
 private:
-    AtomicSharedPtr<Node> top;
+    alignas(CACHE_LINE_SIZE) AtomicSharedPtr<Node> top;
+    StripedCounter counter;
 };
 
 template<typename T>
 void LFStack<T>::push(const T &data) {
+    LATENCY_SCOPE(LatencyOp::Push);
     FAST_LOG(Operation::Push, data);
     SharedPtr<Node> newTop(new Node());
     newTop->next = top.get();
@@ -33,10 +39,12 @@ void LFStack<T>::push(const T &data) {
     while (!top.compareExchange(newTop->next.get(), std::move(newTop))) {
         newTop->next = top.get();
     }
+    counter.add(1);
 }
 
 template<typename T>
 std::optional<T> LFStack<T>::pop() {
+    LATENCY_SCOPE(LatencyOp::Pop);
     FAST_LOG(Operation::Pop, 0);
     FastSharedPtr<Node> res = top.getFast();
     if (res.get() == nullptr)
@@ -48,6 +56,7 @@ std::optional<T> LFStack<T>::pop() {
             return {};
     }
 
+    counter.add(-1);
     return { res.get()->data };
 }
 
@@ -1,6 +1,7 @@
 #include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <chrono>
 #include <functional>
 #include <thread>
@@ -9,12 +10,22 @@
 #include <vector>
 #include <queue>
 #include <map>
+#include <memory>
+#include <string>
 #include <csignal>
 
+#include <unistd.h>
+
 #include "lfstack.h"
 #include "lfqueue.h"
 #include "lfmap.h"
 #include "lfmap_avl.h"
+#include "lfhash_map.h"
+#include "lfbtree_map.h"
+#include "lfskiplist_map.h"
+#include "sharded_map.h"
+#include "lfpriority_queue.h"
+#include "concurrent_cache.h"
 
 void check(bool good) {
     if (!good)
@@ -43,6 +54,207 @@ void atomic_shared_ptr_concurrent_store_load_test() {
     }
 }
 
+void latency_histogram_test() {
+    printf("running latency histogram test...\n");
+    LFStructs::LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 1000; value++)
+        histogram.record(value);
+    check(histogram.count() == 1000);
+    check(histogram.valueAtPercentile(0) == 1);
+    // 1/32 relative error
+    check(histogram.valueAtPercentile(50) >= 500 && histogram.valueAtPercentile(50) <= 516);
+    check(histogram.valueAtPercentile(99) >= 990 && histogram.valueAtPercentile(99) <= 1022);
+    check(histogram.max() >= 1000 && histogram.max() <= 1023);
+
+    LFStructs::LatencyHistogram warmup = histogram;
+    histogram.record(uint64_t(1) << 50);
+    histogram.subtract(warmup);
+    check(histogram.count() == 1);
+    check(histogram.valueAtPercentile(50) >= (uint64_t(1) << 39));
+
+    auto before = LFStructs::latencyHistogram(LFStructs::LatencyOp::Remove);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++)
+        threads.push_back(std::thread([](){
+            for (int j = 0; j < 100; j++)
+                LFStructs::LatencyRegistry::threadHistogram(LFStructs::LatencyOp::Remove).record(j);
+        }));
+    for (auto &thread : threads)
+        thread.join();
+    auto after = LFStructs::latencyHistogram(LFStructs::LatencyOp::Remove);
+    after.subtract(before);
+    check(after.count() == 400);
+}
+
+void pointer_stats_test() {
+    printf("running AtomicSharedPtr stats test...\n");
+    auto before = LFStructs::Stats::snapshot();
+    {
+        LFStructs::AtomicSharedPtr<int> sp(new int(0));
+        auto holder = sp.getFast();
+        check(!sp.compareExchange(nullptr, LFStructs::SharedPtr<int>(new int(1))));
+        check(sp.compareExchange(holder.get(), LFStructs::SharedPtr<int>(new int(2))));
+
+        LFStructs::LFStack<int> stack;
+        for (int i = 0; i < 1000; i++)
+            stack.push(i);
+    }
+    // blocks of exited threads are reused, their counts stay in snapshot
+    for (int i = 0; i < 100; i++)
+        std::thread([i](){
+            LFStructs::AtomicSharedPtr<int> sp;
+            check(sp.compareExchange(nullptr, LFStructs::SharedPtr<int>(new int(i))));
+        }).join();
+
+    auto diff = LFStructs::Stats::snapshot() - before;
+    if (POINTER_STATS_ENABLED) {
+        check(diff.casAttempts >= 1102 && diff.casFailures >= 1);
+        // destroying stack releases nodes one by one through destruction queue
+        check(diff.deferredDestructions >= 999);
+        check(diff.maxDestructionQueue >= 1);
+        LFStructs::Stats::resetMaxima();
+        check(LFStructs::Stats::snapshot().maxDestructionQueue == 0);
+    } else {
+        check(diff.casAttempts == 0 && diff.deferredDestructions == 0);
+    }
+}
+
+#if FAST_LOGGING_ENABLED
+void fast_logger_streaming_test() {
+    printf("running FastLogger streaming test...\n");
+    if (LFStructs::FastLogger::Streaming())
+        return;
+
+    const std::string path = "fast_logger_streaming_test.trace";
+    const uint32_t userType = LFStructs::Operation::User + 1;
+    LFStructs::FastLogger::RegisterEventType(userType, "TestEvent");
+    check(LFStructs::FastLogger::StartStreaming(path, 4 << 20));
+    const int threadCount = 4;
+    const int eventCount = 5000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([i](){
+            for (int j = 0; j < eventCount; j++)
+                FAST_LOG(userType, i * eventCount + j, j);
+        }));
+    for (auto &thread : threads)
+        thread.join();
+    LFStructs::FastLogger::StopStreaming();
+
+    FILE *file = fopen(path.c_str(), "rb");
+    check(file != nullptr);
+    LFStructs::TraceFileHeader header;
+    check(fread(&header, sizeof(header), 1, file) == 1);
+    check(memcmp(header.magic, LFStructs::TRACE_FILE_MAGIC, sizeof(header.magic)) == 0);
+    check(header.droppedEvents.load() == 0);
+    check(header.ticksPerNanosecond > 0);
+    check(strcmp(header.userTypeNames[userType - LFStructs::Operation::User], "TestEvent") == 0);
+
+    // every thread wrote its events in order into its own chunks
+    std::map<uint32_t, std::vector<size_t>> addresses;
+    std::unique_ptr<LFStructs::TraceChunk> chunk(new LFStructs::TraceChunk);
+    for (uint64_t i = 0; i < header.usedChunks.load(); i++) {
+        fseek(file, LFStructs::TRACE_HEADER_SIZE + i * sizeof(LFStructs::TraceChunk), SEEK_SET);
+        check(fread(chunk.get(), sizeof(LFStructs::TraceChunk), 1, file) == 1);
+        for (uint32_t j = 0; j < chunk->count.load(); j++)
+            if (chunk->events[j].type == userType) {
+                check(chunk->events[j].value == addresses[chunk->thread].size());
+                addresses[chunk->thread].push_back(chunk->events[j].address);
+            }
+    }
+    fclose(file);
+    remove(path.c_str());
+
+    check(addresses.size() == threadCount);
+    for (const auto &[thread, values] : addresses) {
+        check(values.size() == eventCount);
+        for (int j = 0; j < eventCount; j++)
+            check(values[j] == values[0] + j);
+    }
+
+    // stopping while threads still log waits for events being written
+    check(LFStructs::FastLogger::StartStreaming(path, 1 << 20));
+    std::atomic<bool> done = false;
+    threads.clear();
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&done](){
+            for (size_t j = 0; !done.load(); j++)
+                FAST_LOG(userType, j);
+        }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    LFStructs::FastLogger::StopStreaming();
+    done.store(true);
+    for (auto &thread : threads)
+        thread.join();
+    remove(path.c_str());
+}
+#endif
+
+void concurrent_cache_test() {
+    printf("running ConcurrentCache test...\n");
+    LFStructs::ConcurrentCache<int, int> cache(4);
+    for (int key = 1; key <= 4; key++)
+        cache.put(key, key * 10);
+    for (int key = 1; key <= 3; key++)
+        check(*cache.get(key).get() == key * 10);
+
+    // clock hand gives referenced 1, 2, 3 a second chance and evicts 4
+    LFStructs::SharedPtr<int> held = cache.get(1);
+    cache.put(5, 50);
+    check(cache.get(4).get() == nullptr);
+    check(*cache.get(5).get() == 50 && *cache.get(2).get() == 20);
+    check(cache.approxSize() == 4);
+
+    cache.put(2, 21);
+    // 1 lost its second chance already and makes room
+    check(*cache.get(2).get() == 21 && cache.approxSize() == 3);
+    cache.erase(3);
+    check(cache.get(3).get() == nullptr && cache.approxSize() == 2);
+
+    for (int key = 100; key < 110; key++)
+        cache.put(key, key);
+    check(cache.get(1).get() == nullptr && cache.approxSize() == 4);
+    // evicted value stays with its reader
+    check(*held.get() == 10);
+
+    auto before = LFStructs::allocationStats();
+    {
+        LFStructs::ConcurrentCache<int, int> shared(100);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 4; i++)
+            threads.push_back(std::thread([&shared, i](){
+                unsigned random = i + 1;
+                for (int j = 0; j < 20000; j++) {
+                    random = random * 1103515245 + 12345;
+                    // a tenth of keys gets most of lookups
+                    int key = (random >> 16) % 10 ? (random >> 8) % 50 : (random >> 8) % 1000;
+                    LFStructs::SharedPtr<int> value = shared.get(key);
+                    if (value.get() == nullptr)
+                        shared.put(key, key * 10);
+                    else
+                        check(*value.get() == key * 10);
+                    if (j % 100 == 0)
+                        shared.erase(key);
+                }
+            }));
+        for (auto &thread : threads)
+            thread.join();
+
+        check(shared.approxSize() <= shared.capacity());
+    }
+    auto after = LFStructs::allocationStats();
+    check(after.objects == before.objects && after.controlBlocks == before.controlBlocks);
+
+    // keys colliding in low hash bits make map chain them instead of growing
+    {
+        LFStructs::ConcurrentCache<long long, int> colliding(16);
+        for (int i = 0; i < 100000; i++)
+            colliding.put((long long)(i % 9) << 40, i);
+        check(colliding.approxSize() == 9);
+        check(LFStructs::allocationStats().controlBlocks - after.controlBlocks < 1000);
+    }
+}
+
 void simple_stack_test() {
     LFStructs::LFStack<int> stack;
     stack.push(5);
@@ -71,6 +283,29 @@ void simple_queue_test() {
     check(!bool(queue.pop()));
 }
 
+void simple_priority_queue_test() {
+    LFStructs::LFPriorityQueue<int, int> queue;
+    queue.push(7, 70);
+    queue.push(5, 50);
+    queue.push(6, 60);
+    check(queue.popMin()->second == 50);
+    queue.push(1, 10);
+    check(queue.popMin()->second == 10);
+    check(queue.popMin()->first == 6);
+    check(queue.popMin()->first == 7);
+    check(!bool(queue.popMin()));
+
+    LFStructs::LFPriorityQueue<int, int> relaxedQueue(4);
+    for (int i = 0; i < 100; i++)
+        relaxedQueue.push(i, i);
+    check(relaxedQueue.approxSize() == 100 && queue.approxSize() == 0);
+    int sum = 0;
+    for (int i = 0; i < 100; i++)
+        sum += relaxedQueue.popMin()->second;
+    check(sum == 4950);
+    check(!bool(relaxedQueue.popMin()));
+}
+
 template<typename Map>
 void simple_map_test() {
     Map map;
@@ -87,6 +322,447 @@ void simple_map_test() {
     check(!bool(map.get(7)));
 }
 
+template<typename Map>
+void map_snapshot_test() {
+    Map map;
+    for (int i = 0; i < 100; i += 2)
+        map.upsert(i, i * 10);
+
+    auto snapshot = map.snapshot();
+    map.remove(10);
+    map.upsert(11, 110);
+    map.upsert(12, -1);
+
+    int expected = 0;
+    for (auto [key, value] : snapshot) {
+        check(key == expected && value == expected * 10);
+        expected += 2;
+    }
+    check(expected == 100);
+
+    check(snapshot.lowerBound(10).key() == 10);
+    check(snapshot.lowerBound(11).key() == 12);
+    check(snapshot.upperBound(10).key() == 12);
+    check(snapshot.lowerBound(99) == snapshot.end());
+    check(*snapshot.get(12) == 120);
+    check(!bool(snapshot.get(11)));
+
+    std::vector<int> keys;
+    for (auto [key, value] : snapshot.range(7, 15))
+        keys.push_back(key);
+    check(keys == std::vector<int>({8, 10, 12, 14}));
+    check(snapshot.range(15, 7).begin() == snapshot.range(15, 7).end());
+
+    auto current = map.snapshot();
+    check(*current.get(11) == 110);
+    check(!bool(current.get(10)));
+    check(std::distance(current.begin(), current.end()) == 50);
+}
+
+template<typename Map>
+void multi_get_map_test() {
+    Map map;
+    for (int i = 0; i < 1000; i += 2)
+        map.upsert(i, i * 10);
+
+    std::vector<int> keys = {998, 3, 0, 500, 500, -1, 1000, 2};
+    std::vector<std::optional<int>> values;
+    map.multiGet(keys, values);
+    check(values.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        check(values[i] == map.get(keys[i]));
+
+    map.multiGet({}, values);
+    check(values.empty());
+
+    auto session = map.readSession();
+    map.upsert(3, 30);
+    map.remove(0);
+    check(!bool(session.get(3)) && *session.get(0) == 0);
+    session.multiGet(keys, values);
+    check(!bool(values[1]) && *values[2] == 0);
+
+    session.refresh();
+    check(*session.get(3) == 30 && !bool(session.get(0)));
+    session.multiGet(keys, values);
+    check(*values[1] == 30 && !bool(values[2]) && *values[0] == 9980);
+}
+
+template<typename Map>
+void map_order_statistics_test() {
+    Map map;
+    check(map.size() == 0);
+    check(!bool(map.select(0)));
+    for (int i = 0; i < 1000; i++)
+        map.upsert(i * 3, i);
+    map.upsert(30, -1);
+    map.remove(33);
+
+    check(map.size() == 999);
+    check(map.rank(0) == 0);
+    check(map.rank(30) == 10);
+    check(map.rank(31) == 11);
+    check(map.rank(36) == 11);
+    check(map.rank(100000) == 999);
+    check(map.select(10)->first == 30 && map.select(10)->second == -1);
+    check(map.select(11)->first == 36);
+    check(map.select(998)->first == 2997);
+    check(!bool(map.select(999)));
+    check(map.countRange(0, 30) == 10);
+    check(map.countRange(30, 40) == 3);
+    check(map.countRange(40, 30) == 0);
+
+    auto snapshot = map.snapshot();
+    map.upsert(1, 1);
+    check(snapshot.size() == 999 && map.size() == 1000);
+    check(snapshot.rank(36) == 11 && map.rank(36) == 12);
+    check(snapshot.select(1)->first == 3 && map.select(1)->first == 1);
+    check(snapshot.countRange(0, 4) == 2);
+}
+
+template<template<typename, typename> class MapTemplate>
+void noop_write_map_test() {
+    using Map = MapTemplate<int, int>;
+    Map map;
+    for (int i = 0; i < 1000; i += 2)
+        map.upsert(i, i * 10);
+
+    // iterators compare node addresses, so equal ones mean path was not copied
+    auto before = map.snapshot();
+    map.upsert(500, 5000);
+    map.remove(501);
+    map.remove(-1);
+    map.applyBatch({Map::BatchOperation::upsert(10, 100), Map::BatchOperation::remove(11)});
+    auto after = map.snapshot();
+    for (int key : {500, 501, 10, 11, 0, 998})
+        check(before.lowerBound(key) == after.lowerBound(key));
+
+    map.upsert(500, 1);
+    check(before.lowerBound(500) != map.snapshot().lowerBound(500));
+    check(*map.get(500) == 1 && map.size() == 500);
+
+    // values without operator== are always written
+    struct Opaque {
+        int value;
+    };
+    MapTemplate<int, Opaque> opaqueMap;
+    opaqueMap.upsert(1, {1});
+    opaqueMap.upsert(1, {2});
+    check(opaqueMap.get(1)->value == 2);
+}
+
+template<typename Map>
+void read_modify_write_map_test() {
+    Map map;
+    check(map.insertIfAbsent(1, 10) == 10);
+    check(map.insertIfAbsent(1, 20) == 10);
+    check(!bool(map.update(2, [](int value) { return value + 1; })));
+    check(!bool(map.get(2)));
+    check(*map.update(1, [](int value) { return value + 1; }) == 11);
+    check(!map.compareAndSet(1, 10, 30));
+    check(map.compareAndSet(1, 11, 30) && *map.get(1) == 30);
+    check(!map.compareAndSet(3, 0, 1) && !bool(map.get(3)));
+    check(!bool(map.compute(1, [](const std::optional<int> &) { return std::optional<int>(); })));
+    check(!bool(map.get(1)));
+
+    // concurrent increments are not lost
+    const int threadCount = 4;
+    const int keyCount = 16;
+    const int increments = 2000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&map](){
+            for (int j = 0; j < increments; j++)
+                map.compute(j % keyCount, [](const std::optional<int> &current) {
+                    return std::optional<int>(current.value_or(0) + 1);
+                });
+        }));
+
+    for (auto &thread : threads)
+        thread.join();
+
+    for (int key = 0; key < keyCount; key++)
+        check(*map.get(key) == threadCount * increments / keyCount);
+}
+
+template<typename Map>
+void map_persistence_test() {
+    const char *path = "map_persistence_test.bin";
+    Map map;
+    for (int i = 0; i < 10000; i++)
+        map.upsert(rand() % 100000, i);
+    check(map.saveSnapshot(path));
+
+    Map loaded;
+    loaded.upsert(-1, -1);
+    check(loaded.loadSnapshot(path));
+    check(loaded.size() == map.size() && !bool(loaded.get(-1)));
+    auto expected = map.snapshot();
+    auto actual = loaded.snapshot();
+    check(std::equal(expected.begin(), expected.end(), actual.begin(), actual.end()));
+    check(loaded.rank(50000) == map.rank(50000));
+
+    // value size doesn't match
+    LFStructs::LFMap<int, long long> other;
+    check(!other.loadSnapshot(path));
+    remove(path);
+    check(!loaded.loadSnapshot(path) && loaded.size() == map.size());
+
+    Map empty;
+    check(empty.saveSnapshot(path) && loaded.loadSnapshot(path) && loaded.size() == 0);
+    remove(path);
+}
+
+template<typename Map>
+void bulk_load_map_test() {
+    std::vector<std::pair<int, int>> entries;
+    for (int i = 0; i < 200000; i++)
+        entries.push_back({i * 2, i});
+
+    for (size_t threadCount : {1, 4}) {
+        Map map(LFStructs::bulkLoad, entries.begin(), entries.end(), threadCount);
+        check(map.size() == entries.size());
+        check(*map.get(1000) == 500 && !bool(map.get(1001)));
+        check(map.select(12345)->first == 24690 && map.rank(24690) == 12345);
+
+        map.upsert(1001, 1);
+        map.remove(0);
+        check(map.size() == entries.size() && *map.get(1001) == 1 && !bool(map.get(0)));
+    }
+
+    std::map<int, int> ordered = {{1, 10}, {5, 50}, {7, 70}};
+    auto fromMap = Map::fromSorted(ordered.begin(), ordered.end());
+    auto snapshot = fromMap.snapshot();
+    check(std::equal(snapshot.begin(), snapshot.end(), ordered.begin(), ordered.end(),
+                     [](const auto &a, const auto &b) { return a.first == b.first && a.second == b.second; }));
+
+    auto empty = Map::fromSorted(entries.end(), entries.end());
+    check(empty.size() == 0 && !bool(empty.get(0)));
+}
+
+template<typename Map>
+void batch_map_test() {
+    Map lfMap;
+    std::map<int, int> map;
+    for (int i = 0; i < 1000; i++) {
+        std::vector<typename Map::BatchOperation> ops;
+        int count = rand() % 100;
+        for (int j = 0; j < count; j++) {
+            int key = rand() % 300;
+            if (rand() % 3) {
+                int value = rand();
+                ops.push_back(Map::BatchOperation::upsert(key, value));
+                map[key] = value;
+            } else {
+                ops.push_back(Map::BatchOperation::remove(key));
+                map.erase(key);
+            }
+        }
+        lfMap.applyBatch(std::move(ops));
+
+        check(lfMap.size() == map.size());
+        for (int key = 0; key < 300; key++) {
+            auto value = lfMap.get(key);
+            check(bool(value) == bool(map.count(key)));
+            check(!value || *value == map[key]);
+        }
+    }
+}
+
+template<typename Map>
+void combining_map_test() {
+    Map map(LFStructs::WriteMode::Combining);
+    const int threadCount = 4;
+    const int keysPerThread = 5000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&map, i](){
+            for (int key = i; key < threadCount * keysPerThread; key += threadCount)
+                map.upsert(key, key * 2);
+            for (int key = i; key < threadCount * keysPerThread; key += 2 * threadCount)
+                map.remove(key);
+        }));
+
+    for (auto &thread : threads)
+        thread.join();
+
+    check(map.size() == threadCount * keysPerThread / 2);
+    for (int key = 0; key < threadCount * keysPerThread; key++)
+        check(bool(map.get(key)) == bool(key % (2 * threadCount) >= threadCount));
+}
+
+template<typename Map>
+void sharded_map_test(Map &map) {
+    for (int i = 0; i < 1000; i++)
+        map.upsert(i, i * 2);
+    for (int i = 0; i < 1000; i += 3)
+        map.remove(i);
+    check(*map.get(1) == 2);
+    check(!bool(map.get(3)));
+
+    auto snapshot = map.snapshot();
+    map.upsert(3, 6);
+    check(snapshot.size() == 666);
+    check(!bool(snapshot.get(3)) && *map.get(3) == 6);
+
+    int previous = -1;
+    int count = 0;
+    for (auto [key, value] : snapshot) {
+        check(previous < key && key % 3 != 0 && value == key * 2);
+        previous = key;
+        count++;
+    }
+    check(count == 666);
+    check(snapshot.lowerBound(300).key() == 301);
+
+    std::vector<int> keys;
+    for (auto [key, value] : snapshot.range(10, 20))
+        keys.push_back(key);
+    check(keys == std::vector<int>({10, 11, 13, 14, 16, 17, 19}));
+
+    size_t upserts = 0;
+    size_t removes = 0;
+    size_t size = 0;
+    for (size_t i = 0; i < 4; i++) {
+        auto stats = map.stats(i);
+        upserts += stats.upserts;
+        removes += stats.removes;
+        size += stats.size;
+    }
+    check(upserts == 1001 && removes == 334 && size == 667);
+    check(map.approxSize() == 667);
+}
+
+// shard maps without snapshots
+template<typename ShardMap>
+void sharded_unordered_map_test() {
+    LFStructs::ShardedMap<ShardMap, 4> map;
+    for (int i = 0; i < 1000; i++)
+        map.upsert(i, i * 2);
+    for (int i = 0; i < 1000; i += 3)
+        map.remove(i);
+    map.upsert(3, 6);
+
+    for (int i = 0; i < 1000; i++) {
+        auto value = map.get(i);
+        check(bool(value) == (i % 3 != 0 || i == 3));
+        check(!value || *value == i * 2);
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < 4; i++)
+        size += map.stats(i).size;
+    check(size == 667 && map.approxSize() == 667);
+}
+
+template<typename Map>
+void map_iteration_test() {
+    Map map;
+    const int threadCount = 4;
+    std::vector<std::thread> threads;
+    // writers own disjoint keys, odd keys are stable while even ones come and go
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&map, i](){
+            for (int key = 2 * i + 1; key < 2000; key += 2 * threadCount)
+                map.upsert(key, key * 10);
+            for (int round = 0; round < 20; round++)
+                for (int key = 2 * i; key < 2000; key += 2 * threadCount) {
+                    if (round % 2)
+                        map.remove(key);
+                    else
+                        map.upsert(key, round);
+                }
+        }));
+
+    for (int scan = 0; scan < 20; scan++) {
+        int previous = -1;
+        for (auto [key, value] : map) {
+            check(key > previous);
+            previous = key;
+        }
+    }
+    for (auto &thread : threads)
+        thread.join();
+
+    int expected = 1;
+    for (auto [key, value] : map) {
+        check(key == expected && value == key * 10);
+        expected += 2;
+    }
+    check(expected == 2001);
+    check(map.approxSize() == 1000);
+
+    check(map.lowerBound(10).key() == 11);
+    check(map.lowerBound(11).value() == 110);
+    check(map.lowerBound(2000) == map.end());
+    map.remove(11);
+    check(map.lowerBound(10).key() == 13);
+}
+
+template<typename Map>
+void map_size_test() {
+    auto before = LFStructs::allocationStats();
+    {
+        Map map;
+        const int threadCount = 4;
+        std::vector<std::thread> threads;
+        for (int i = 0; i < threadCount; i++)
+            threads.push_back(std::thread([&map, i](){
+                for (int key = i; key < 4000; key += threadCount)
+                    map.upsert(key, key);
+                for (int key = i; key < 4000; key += 2 * threadCount)
+                    map.remove(key);
+                map.remove(-1);
+                map.upsert(7, 7);
+            }));
+        for (auto &thread : threads)
+            thread.join();
+
+        check(map.approxSize() == 2000);
+        if (ALLOCATION_STATS_ENABLED)
+            check(LFStructs::allocationStats().objects > before.objects);
+    }
+    auto after = LFStructs::allocationStats();
+    check(after.objects == before.objects && after.controlBlocks == before.controlBlocks);
+}
+
+void hash_map_collision_test() {
+    auto before = LFStructs::allocationStats();
+    {
+        // std::hash of integers is identity, so these keys share all low bits
+        LFStructs::LFHashMap<long long, int> map;
+        for (int i = 0; i < 100000; i++)
+            map.upsert((long long)(i % 9) << 40, i);
+
+        check(map.approxSize() == 9);
+        check(*map.get(8LL << 40) == 99998);
+        // a table per write would leave hundreds of thousands of buckets behind
+        check(LFStructs::allocationStats().controlBlocks - before.controlBlocks < 1000);
+    }
+    auto after = LFStructs::allocationStats();
+    check(after.objects == before.objects && after.controlBlocks == before.controlBlocks);
+}
+
+template<typename Container>
+void sequence_size_test() {
+    Container container;
+    const int threadCount = 4;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&container](){
+            for (int j = 0; j < 1000; j++)
+                container.push(j);
+            for (int j = 0; j < 300; j++)
+                container.pop();
+        }));
+    for (auto &thread : threads)
+        thread.join();
+
+    check(container.approxSize() == threadCount * 700);
+    while (container.pop());
+    check(container.approxSize() == 0);
+}
+
 template<typename Map>
 void correctness_map_test() {
     Map lfMap;
@@ -120,23 +796,31 @@ void correctness_map_test() {
     printf("\n");
 }
 
-template<typename Map>
+template<typename Map, LFStructs::WriteMode Mode>
+Map* createMap() {
+    if constexpr (Mode == LFStructs::WriteMode::Direct)
+        return new Map();
+    else
+        return new Map(Mode);
+}
+
+template<typename Map, int WritePercent = 2, LFStructs::WriteMode Mode = LFStructs::WriteMode::Direct>
 void lfmap_stress_test(int actionNumber, int threadCount) {
     std::vector<std::thread> threads;
-    Map map;
+    std::unique_ptr<Map> map(createMap<Map, Mode>());
     for (int i = 0; i < 10000; i++)
-        map.upsert(rand() % 1000000, rand());
+        map->upsert(rand() % 1000000, rand());
     for (int i = 0; i < threadCount; i++)
         threads.push_back(std::thread([&map, actionNumber, threadCount](){
             const int MAX = 1000;
             for (int j = 0; j < actionNumber / threadCount; j++) {
                 int op = rand() % 100;
-                if (op < 1)
-                    map.remove(rand() % MAX);
-                else if (op < 2)
-                    map.upsert(rand() % MAX, rand());
+                if (op < WritePercent / 2)
+                    map->remove(rand() % MAX);
+                else if (op < WritePercent)
+                    map->upsert(rand() % MAX, rand());
                 else
-                    map.get(rand() % MAX);
+                    map->get(rand() % MAX);
             }
         }));
 
@@ -170,6 +854,33 @@ void lockable_map_stress_test(int actionNumber, int threadCount) {
         thread.join();
 }
 
+// mutex baseline for write-heavy map tests, writes split evenly between erase and insert like in lfmap_stress_test
+void write_heavy_lockable_map_stress_test(int actionNumber, int threadCount) {
+    std::vector<std::thread> threads;
+    std::map<int, int> map;
+    std::mutex mutex;
+    for (int i = 0; i < 10000; i++)
+        map[rand() % 1000000] = rand();
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([&map, &mutex, actionNumber, threadCount](){
+            const int MAX = 1000;
+            for (int j = 0; j < actionNumber / threadCount; j++) {
+                int op = rand() % 100;
+                mutex.lock();
+                if (op < 25)
+                    map.erase(rand() % MAX);
+                else if (op < 50)
+                    map[rand() % MAX] = rand();
+                else
+                    map.find(rand() % MAX);
+                mutex.unlock();
+            }
+        }));
+
+    for (auto &thread : threads)
+        thread.join();
+}
+
 template<typename T>
 void stress_test_lockable_stack(int actionNumber, int threadCount) {
     std::vector<std::thread> threads;
@@ -243,6 +954,76 @@ void stress_test(int actionNumber, int threadCount) {
         check(allGenerated[i] == allExtracted[i]);
 }
 
+template<int HeapsPerThread>
+void priority_queue_stress_test(int actionNumber, int threadCount) {
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int>> generated(threadCount);
+    std::vector<std::vector<int>> extracted(threadCount);
+    LFStructs::LFPriorityQueue<int, int> queue(HeapsPerThread * threadCount);
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([i, actionNumber, &queue, &generated, &extracted, threadCount](){
+            for (int j = 0; j < actionNumber / threadCount; j++) {
+                if (rand() % 2) {
+                    int a = rand();
+                    queue.push(a, a);
+                    generated[i].push_back(a);
+                } else {
+                    auto a = queue.popMin();
+                    if (a) {
+                        check(a->first == a->second);
+                        extracted[i].push_back(a->second);
+                    }
+                }
+            }
+        }));
+
+    for (auto &thread : threads)
+        thread.join();
+
+    std::vector<int> allGenerated;
+    std::vector<int> allExtracted;
+    for (int i = 0; i < threadCount; i++) {
+        allGenerated.insert(allGenerated.end(), generated[i].begin(), generated[i].end());
+        allExtracted.insert(allExtracted.end(), extracted[i].begin(), extracted[i].end());
+    }
+
+    int previous = -1;
+    while (auto a = queue.popMin()) {
+        if (!queue.relaxed())
+            check(previous <= a->first);
+        previous = a->first;
+        allExtracted.push_back(a->second);
+    }
+
+    check(allGenerated.size() == allExtracted.size());
+    std::sort(allGenerated.begin(), allGenerated.end());
+    std::sort(allExtracted.begin(), allExtracted.end());
+    check(allGenerated == allExtracted);
+}
+
+void lockable_priority_queue_stress_test(int actionNumber, int threadCount) {
+    std::vector<std::thread> threads;
+    std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> queue;
+    std::mutex lock;
+    for (int i = 0; i < threadCount; i++)
+        threads.push_back(std::thread([actionNumber, &queue, &lock, threadCount](){
+            for (int j = 0; j < actionNumber / threadCount; j++) {
+                bool op = rand() % 2;
+                lock.lock();
+                if (op) {
+                    int a = rand();
+                    queue.push({a, a});
+                } else if (queue.size()) {
+                    queue.pop();
+                }
+                lock.unlock();
+            }
+        }));
+
+    for (auto &thread : threads)
+        thread.join();
+}
+
 void abstractStressTest(std::function<void(int, int)> f) {
     for (int i = 1; i <= std::thread::hardware_concurrency(); i++)
         printf("\t%d", i);
@@ -265,30 +1046,133 @@ void all_map_tests() {
     simple_map_test<LFStructs::LFMap<int, int>>();
     printf("running simple LFMapAvl test...\n");
     simple_map_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running simple LFHashMap test...\n");
+    simple_map_test<LFStructs::LFHashMap<int, int>>();
+    printf("running simple LFBTreeMap test...\n");
+    simple_map_test<LFStructs::LFBTreeMap<int, int>>();
+    printf("running simple LFSkipListMap test...\n");
+    simple_map_test<LFStructs::LFSkipListMap<int, int>>();
+    printf("running LFMap snapshot test...\n");
+    map_snapshot_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl snapshot test...\n");
+    map_snapshot_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running LFMap multiGet test...\n");
+    multi_get_map_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl multiGet test...\n");
+    multi_get_map_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running LFMap order statistics test...\n");
+    map_order_statistics_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl order statistics test...\n");
+    map_order_statistics_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running LFMap no-op write test...\n");
+    noop_write_map_test<LFStructs::LFMap>();
+    printf("running LFMapAvl no-op write test...\n");
+    noop_write_map_test<LFStructs::LFMapAvl>();
+    printf("running LFMap read-modify-write test...\n");
+    read_modify_write_map_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl read-modify-write test...\n");
+    read_modify_write_map_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running LFMap persistence test...\n");
+    map_persistence_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl persistence test...\n");
+    map_persistence_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running LFMap bulk load test...\n");
+    bulk_load_map_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl bulk load test...\n");
+    bulk_load_map_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running LFMap size test...\n");
+    map_size_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl size test...\n");
+    map_size_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running LFHashMap size test...\n");
+    map_size_test<LFStructs::LFHashMap<int, int>>();
+    printf("running LFHashMap collision test...\n");
+    hash_map_collision_test();
+    printf("running LFBTreeMap size test...\n");
+    map_size_test<LFStructs::LFBTreeMap<int, int, 4>>();
+    printf("running LFSkipListMap size test...\n");
+    map_size_test<LFStructs::LFSkipListMap<int, int>>();
+    printf("running LFSkipListMap iteration test...\n");
+    map_iteration_test<LFStructs::LFSkipListMap<int, int>>();
+    printf("running LFMap batch test...\n");
+    batch_map_test<LFStructs::LFMap<int, int>>();
+    printf("running LFMapAvl batch test...\n");
+    batch_map_test<LFStructs::LFMapAvl<int, int>>();
+    printf("running hash sharded map test...\n");
+    LFStructs::ShardedMap<LFStructs::LFMapAvl<int, int>, 4> hashSharded;
+    sharded_map_test(hashSharded);
+    printf("running range sharded map test...\n");
+    LFStructs::ShardedMap<LFStructs::LFMap<int, int>, 4, LFStructs::RangeRouter<int>> rangeSharded(
+                LFStructs::RangeRouter<int>({250, 500, 750}));
+    sharded_map_test(rangeSharded);
+    check(rangeSharded.shardOf(249) == 0 && rangeSharded.shardOf(750) == 3);
+    printf("running sharded LFHashMap test...\n");
+    sharded_unordered_map_test<LFStructs::LFHashMap<int, int>>();
+    printf("running sharded LFBTreeMap test...\n");
+    sharded_unordered_map_test<LFStructs::LFBTreeMap<int, int>>();
+    printf("running combining LFMap test...\n");
+    combining_map_test<LFStructs::LFMap<int, int>>();
+    printf("running combining LFMapAvl test...\n");
+    combining_map_test<LFStructs::LFMapAvl<int, int>>();
 
 #ifndef MSAN
     printf("\nrunning correctness LFMap test...\n");
     correctness_map_test<LFStructs::LFMap<int, int>>();
     printf("\nrunning correctness LFMapAvl test...\n");
     correctness_map_test<LFStructs::LFMapAvl<int, int>>();
+    printf("\nrunning correctness LFHashMap test...\n");
+    correctness_map_test<LFStructs::LFHashMap<int, int>>();
+    printf("\nrunning correctness LFBTreeMap test...\n");
+    correctness_map_test<LFStructs::LFBTreeMap<int, int, 4>>();
+    printf("\nrunning correctness LFSkipListMap test...\n");
+    correctness_map_test<LFStructs::LFSkipListMap<int, int>>();
 #endif
 
     printf("\nrunning LFMap stress test...\n");
     abstractStressTest(lfmap_stress_test<LFStructs::LFMap<int, int>>);
     printf("\nrunning LFMapAvl stress test...\n");
     abstractStressTest(lfmap_stress_test<LFStructs::LFMapAvl<int, int>>);
+    printf("\nrunning LFHashMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFHashMap<int, int>>);
+    printf("\nrunning LFBTreeMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFBTreeMap<int, int>>);
+    printf("\nrunning LFSkipListMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFSkipListMap<int, int>>);
 
 #ifndef MSAN
     printf("\nrunning lockable map stress test\n");
     abstractStressTest(lockable_map_stress_test);
 #endif
 
+    printf("\nrunning write-heavy LFMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFMap<int, int>, 50>);
+    printf("\nrunning write-heavy combining LFMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFMap<int, int>, 50, LFStructs::WriteMode::Combining>);
+    printf("\nrunning write-heavy LFMapAvl stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFMapAvl<int, int>, 50>);
+    printf("\nrunning write-heavy combining LFMapAvl stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFMapAvl<int, int>, 50, LFStructs::WriteMode::Combining>);
+    printf("\nrunning write-heavy LFHashMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFHashMap<int, int>, 50>);
+    printf("\nrunning write-heavy LFBTreeMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFBTreeMap<int, int>, 50>);
+    printf("\nrunning write-heavy LFSkipListMap stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::LFSkipListMap<int, int>, 50>);
+    printf("\nrunning write-heavy sharded LFMapAvl stress test...\n");
+    abstractStressTest(lfmap_stress_test<LFStructs::ShardedMap<LFStructs::LFMapAvl<int, int>, 16>, 50>);
+#ifndef MSAN
+    printf("\nrunning write-heavy lockable map stress test\n");
+    abstractStressTest(write_heavy_lockable_map_stress_test);
+#endif
+
     printf("\n\n");
 }
 
 void all_queue_tests() {
     printf("running simple LFQueue test...\n");
     simple_queue_test();
+    printf("running LFQueue size test...\n");
+    sequence_size_test<LFStructs::LFQueue<int>>();
     printf("\nrunning LFQueue stress test...\n");
     abstractStressTest(stress_test<LFStructs::LFQueue<int>>);
     printf("\nrunning lockable queue stress test...\n");
@@ -299,6 +1183,8 @@ void all_queue_tests() {
 void all_stack_tests() {
     printf("running simple LFStack test...\n");
     simple_stack_test();
+    printf("running LFStack size test...\n");
+    sequence_size_test<LFStructs::LFStack<int>>();
     printf("\nrunning LFStack stress test...\n");
     abstractStressTest(stress_test<LFStructs::LFStack<int>>);
     printf("\nrunning lockable stack stress test...\n");
@@ -306,8 +1192,23 @@ void all_stack_tests() {
     printf("\n");
 }
 
+void all_priority_queue_tests() {
+    printf("running simple LFPriorityQueue test...\n");
+    simple_priority_queue_test();
+    printf("\nrunning LFPriorityQueue stress test...\n");
+    abstractStressTest(priority_queue_stress_test<0>);
+    printf("\nrunning relaxed LFPriorityQueue stress test...\n");
+    abstractStressTest(priority_queue_stress_test<2>);
+    printf("\nrunning lockable priority queue stress test...\n");
+    abstractStressTest(lockable_priority_queue_stress_test);
+    printf("\n");
+}
+
 void abortTraceLogger(int sig) {
 #if FAST_LOGGING_ENABLED
+    // streamed trace is already in file
+    if (LFStructs::FastLogger::Streaming())
+        _exit(1);
     LFStructs::FastLogger::PrintTrace();
     exit(0);
 #endif
@@ -316,9 +1217,24 @@ void abortTraceLogger(int sig) {
 int main()
 {
     signal(SIGABRT, abortTraceLogger);
+#if FAST_LOGGING_ENABLED
+    // FAST_LOG_FILE=trace ./AtomicSharedPtr && ./TraceConverter trace trace.json
+    if (const char *traceFile = getenv("FAST_LOG_FILE"))
+        check(LFStructs::FastLogger::StartStreaming(traceFile));
+#endif
     atomic_shared_ptr_concurrent_store_load_test();
+    latency_histogram_test();
+    pointer_stats_test();
+#if FAST_LOGGING_ENABLED
+    fast_logger_streaming_test();
+#endif
     all_map_tests();
+    concurrent_cache_test();
     all_queue_tests();
     all_stack_tests();
+    all_priority_queue_tests();
+#if FAST_LOGGING_ENABLED
+    LFStructs::FastLogger::StopStreaming();
+#endif
     return 0;
 }
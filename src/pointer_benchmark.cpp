@@ -0,0 +1,326 @@
+/* AtomicSharedPtr operations alone and in read/write mixes against
+ * std::atomic<std::shared_ptr> (C++20) and std::atomic_load/atomic_store on
+ * std::shared_ptr, which libstdc++ and libc++ implement with locks.
+ *
+ * Usage: PointerBenchmark [--duration=1] [--warmup=0.2] [--threads=1,2,4] [--pin] [--format=text|csv]
+ *
+ * Every thread hammers one shared pointer for a fixed time. Where
+ * perf_event_open is allowed (see /proc/sys/kernel/perf_event_paranoid),
+ * cycles, instructions and cache misses of worker threads are reported per
+ * operation, otherwise those columns are empty. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "atomic_shared_ptr.h"
+#include "benchmark_harness.h"
+
+namespace {
+
+enum class Workload {
+    Read,
+    Store,
+    Cas,
+    // 90% reads, 10% stores
+    Mix90,
+    Mix50
+};
+
+const char *workloadName(Workload workload) {
+    switch (workload) {
+    case Workload::Read: return "read";
+    case Workload::Store: return "store";
+    case Workload::Cas: return "cas+1";
+    case Workload::Mix90: return "90r/10w";
+    case Workload::Mix50: return "50r/50w";
+    }
+    return "";
+}
+
+/* Each implementation has read() returning pointed value, store(value) and
+ * increment() which retries compare-exchange until value is replaced by value + 1. */
+template<bool Fast>
+class AtomicSharedPtrImpl {
+public:
+    AtomicSharedPtrImpl(): ptr(new int(0)) {}
+
+    int read() {
+        if constexpr (Fast) {
+            LFStructs::FastSharedPtr<int> copy = ptr.getFast();
+            return *copy.get();
+        } else {
+            LFStructs::SharedPtr<int> copy = ptr.get();
+            return *copy.get();
+        }
+    }
+
+    void store(int value) { ptr.store(new int(value)); }
+
+    void increment() {
+        while (true) {
+            LFStructs::FastSharedPtr<int> current = ptr.getFast();
+            if (ptr.compareExchange(current.get(), LFStructs::SharedPtr<int>(new int(*current.get() + 1))))
+                return;
+        }
+    }
+
+private:
+    LFStructs::AtomicSharedPtr<int> ptr;
+};
+
+#ifdef __cpp_lib_atomic_shared_ptr
+class StdAtomicImpl {
+public:
+    StdAtomicImpl(): ptr(std::make_shared<int>(0)) {}
+
+    int read() { return *ptr.load(); }
+    void store(int value) { ptr.store(std::make_shared<int>(value)); }
+    void increment() {
+        std::shared_ptr<int> current = ptr.load();
+        while (!ptr.compare_exchange_weak(current, std::make_shared<int>(*current + 1))) {}
+    }
+
+private:
+    std::atomic<std::shared_ptr<int>> ptr;
+};
+#endif
+
+// free functions are deprecated in C++20 in favour of std::atomic<std::shared_ptr>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+class FreeFunctionsImpl {
+public:
+    FreeFunctionsImpl(): ptr(std::make_shared<int>(0)) {}
+
+    int read() { return *std::atomic_load(&ptr); }
+    void store(int value) { std::atomic_store(&ptr, std::make_shared<int>(value)); }
+    void increment() {
+        std::shared_ptr<int> current = std::atomic_load(&ptr);
+        while (!std::atomic_compare_exchange_weak(&ptr, &current, std::make_shared<int>(*current + 1))) {}
+    }
+
+private:
+    std::shared_ptr<int> ptr;
+};
+#pragma GCC diagnostic pop
+
+/* Hardware counters of calling thread. Every counter is optional, value is -1
+ * if kernel refused to open it. */
+class PerfCounters {
+public:
+    enum Counter { Cycles, Instructions, CacheMisses, COUNTER_COUNT };
+
+    PerfCounters() {
+#ifdef __linux__
+        const uint64_t configs[COUNTER_COUNT] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+        };
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int fd : fds)
+            if (fd >= 0)
+                close(fd);
+#endif
+    }
+
+    // false if none of counters could be opened
+    bool available() const {
+        return std::any_of(std::begin(fds), std::end(fds), [](int fd){ return fd >= 0; });
+    }
+
+    PerfCounters(const PerfCounters &other) = delete;
+    PerfCounters& operator=(const PerfCounters &other) = delete;
+
+    void start() {
+#ifdef __linux__
+        for (int fd : fds)
+            if (fd >= 0) {
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+    }
+
+    void stop(long long values[COUNTER_COUNT]) {
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            values[i] = -1;
+#ifdef __linux__
+            if (fds[i] >= 0) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                uint64_t value;
+                if (read(fds[i], &value, sizeof(value)) == sizeof(value))
+                    values[i] = value;
+            }
+#endif
+        }
+    }
+
+private:
+    int fds[COUNTER_COUNT] = {-1, -1, -1};
+};
+
+struct Config : Benchmark::Options {
+    Config(): Options(1, 0.2) {}
+};
+
+struct Result {
+    uint64_t ops;
+    double seconds;
+    // summed over threads, -1 if any thread couldn't count
+    long long counters[PerfCounters::COUNTER_COUNT];
+};
+
+template<typename Impl>
+Result run(const Config &config, Workload workload, int threadCount) {
+    struct alignas(LFStructs::CACHE_LINE_SIZE) ThreadResult {
+        std::unique_ptr<PerfCounters> perf;
+        long long counters[PerfCounters::COUNTER_COUNT];
+        // keeps reads from being optimized out
+        int sink = 0;
+        int stored = 0;
+    };
+
+    Impl impl;
+    std::vector<ThreadResult> results(threadCount);
+    Benchmark::RunHooks hooks;
+    // counters follow thread which opened them
+    hooks.threadStarted = [&results](int thread){ results[thread].perf.reset(new PerfCounters()); };
+    hooks.measureStarted = [&results](int thread){ results[thread].perf->start(); };
+    hooks.threadFinished = [&results](int thread){ results[thread].perf->stop(results[thread].counters); };
+
+    int readPercent = workload == Workload::Mix90 ? 90 : 50;
+    Benchmark::RunResult run = Benchmark::runThreads(config, threadCount, [&](Benchmark::Random &random, int thread){
+        ThreadResult &result = results[thread];
+        switch (workload) {
+        case Workload::Read:
+            result.sink += impl.read();
+            break;
+        case Workload::Store:
+            impl.store(result.stored++);
+            break;
+        case Workload::Cas:
+            impl.increment();
+            break;
+        case Workload::Mix90:
+        case Workload::Mix50:
+            if (int(random.next() % 100) < readPercent)
+                result.sink += impl.read();
+            else
+                impl.store(result.stored++);
+            break;
+        }
+    }, hooks);
+
+    Result res;
+    res.ops = run.ops();
+    res.seconds = run.seconds;
+    for (int i = 0; i < PerfCounters::COUNTER_COUNT; i++)
+        res.counters[i] = 0;
+    for (const ThreadResult &result : results)
+        for (int i = 0; i < PerfCounters::COUNTER_COUNT; i++)
+            res.counters[i] = res.counters[i] < 0 || result.counters[i] < 0 ? -1 : res.counters[i] + result.counters[i];
+    return res;
+}
+
+class Printer {
+public:
+    explicit Printer(const std::string &format): format(format) {
+        if (format == "csv")
+            printf("implementation,workload,threads,mops,ns_per_op,cycles_per_op,instructions_per_op,cache_misses_per_op\n");
+        else
+            printf("%-28s %-8s %7s %10s %10s %10s %10s %12s\n",
+                   "implementation", "workload", "threads", "Mop/s", "ns/op", "cycles/op", "instr/op", "misses/op");
+    }
+
+    void print(const char *name, Workload workload, int threadCount, const Result &result) {
+        double mops = result.ops / result.seconds / 1e6;
+        // latency of one operation as seen by one thread
+        double nanoseconds = result.ops ? result.seconds * threadCount / result.ops * 1e9 : 0;
+        std::string counters[PerfCounters::COUNTER_COUNT];
+        for (int i = 0; i < PerfCounters::COUNTER_COUNT; i++) {
+            if (result.counters[i] >= 0 && result.ops) {
+                char buffer[32];
+                snprintf(buffer, sizeof(buffer), "%.2f", double(result.counters[i]) / result.ops);
+                counters[i] = buffer;
+            } else if (format != "csv") {
+                counters[i] = "-";
+            }
+        }
+
+        if (format == "csv")
+            printf("%s,%s,%d,%.4f,%.2f,%s,%s,%s\n", name, workloadName(workload), threadCount, mops, nanoseconds,
+                   counters[0].c_str(), counters[1].c_str(), counters[2].c_str());
+        else
+            printf("%-28s %-8s %7d %10.3f %10.1f %10s %10s %12s\n", name, workloadName(workload), threadCount, mops, nanoseconds,
+                   counters[0].c_str(), counters[1].c_str(), counters[2].c_str());
+        fflush(stdout);
+    }
+
+private:
+    std::string format;
+};
+
+template<typename Impl>
+void benchmark(const char *name, const Config &config, Printer &printer, std::vector<Workload> workloads) {
+    for (Workload workload : workloads)
+        for (int threadCount : config.threadCounts)
+            printer.print(name, workload, threadCount, run<Impl>(config, workload, threadCount));
+}
+
+Config parseArguments(int argc, char **argv) {
+    Config config;
+    Benchmark::parseArguments(argc, argv, config, [](const std::string &, const std::string &){ return false; });
+    return config;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config config = parseArguments(argc, argv);
+    if (!PerfCounters().available())
+        fprintf(stderr, "perf_event_open is not permitted, hardware counters are not reported\n");
+    Printer printer(config.format);
+
+    const std::vector<Workload> all = {Workload::Read, Workload::Store, Workload::Cas, Workload::Mix90, Workload::Mix50};
+    benchmark<AtomicSharedPtrImpl<false>>("AtomicSharedPtr::get", config, printer, all);
+    // store and compareExchange are the same, only reads differ
+    benchmark<AtomicSharedPtrImpl<true>>("AtomicSharedPtr::getFast", config, printer,
+                                         {Workload::Read, Workload::Mix90, Workload::Mix50});
+#ifdef __cpp_lib_atomic_shared_ptr
+    benchmark<StdAtomicImpl>("std::atomic<shared_ptr>", config, printer, all);
+#else
+    fprintf(stderr, "standard library has no std::atomic<std::shared_ptr>, skipping it\n");
+#endif
+    benchmark<FreeFunctionsImpl>("std::atomic_load/store", config, printer, all);
+
+    return 0;
+}
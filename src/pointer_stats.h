@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef POINTER_STATS_ENABLED
+#define POINTER_STATS_ENABLED 0
+#endif
+
+#if not POINTER_STATS_ENABLED
+#define POINTER_STATS_ADD(counter, value) (static_cast<void>(0))
+#define POINTER_STATS_MAX(counter, value) (static_cast<void>(0))
+#else
+#define POINTER_STATS_ADD(counter, value) LFStructs::Stats::local().add(LFStructs::Stats::counter, value)
+#define POINTER_STATS_MAX(counter, value) LFStructs::Stats::local().max(LFStructs::Stats::counter, value)
+#endif
+
+namespace LFStructs {
+
+struct StatsSnapshot {
+    // compareExchange calls which had to change pointer and how many of them returned false
+    uint64_t casAttempts;
+    uint64_t casFailures;
+    // get() found another control block or zero local refcount and returned its own reference
+    uint64_t getAborts;
+    // FastSharedPtr moved more than 1000 local references to control block
+    uint64_t localRefTransfers;
+    // compareExchange moved local references of readers to control block before swapping it
+    uint64_t casRefTransfers;
+    // destructions queued by thread which was already destroying a chain of nodes
+    uint64_t deferredDestructions;
+    // longest destruction queue seen by any thread since last Stats::resetMaxima()
+    uint64_t maxDestructionQueue;
+
+    // maximum is not a sum, difference keeps the later one, so reset maxima between the two snapshots
+    StatsSnapshot operator-(const StatsSnapshot &earlier) const {
+        return {casAttempts - earlier.casAttempts,
+                casFailures - earlier.casFailures,
+                getAborts - earlier.getAborts,
+                localRefTransfers - earlier.localRefTransfers,
+                casRefTransfers - earlier.casRefTransfers,
+                deferredDestructions - earlier.deferredDestructions,
+                maxDestructionQueue};
+    }
+};
+
+/* Contention and reclamation counters of AtomicSharedPtr, compiled in with
+ * POINTER_STATS_ENABLED. Every thread writes only its own cache line aligned
+ * block of counters, so counting is a thread_local lookup and a plain
+ * increment.
+ *
+ * Block of exited thread goes to free list and is handed to the next new
+ * thread, which keeps adding to its counters, so snapshot() still counts
+ * everything while number of blocks stays at the peak number of threads.
+ * Pointers destroyed by thread_local destructors after that count into a
+ * shared block, where concurrent updates may get lost.
+ *
+ * Stats and its blocks are never freed: pointers may be destroyed by static
+ * destructors after thread_local storage and other statics are gone. */
+class Stats {
+public:
+    enum Counter {
+        CasAttempts,
+        CasFailures,
+        GetAborts,
+        LocalRefTransfers,
+        CasRefTransfers,
+        DeferredDestructions,
+        MaxDestructionQueue,
+        COUNTER_COUNT
+    };
+
+    // 128 is CACHE_LINE_SIZE of atomic_shared_ptr.h, which includes this header
+    class alignas(128) ThreadStats {
+    public:
+        void add(Counter counter, uint64_t value) {
+            auto &slot = values[counter];
+            slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+
+        void max(Counter counter, uint64_t value) {
+            auto &slot = values[counter];
+            if (slot.load(std::memory_order_relaxed) < value)
+                slot.store(value, std::memory_order_relaxed);
+        }
+
+    private:
+        std::atomic<uint64_t> values[COUNTER_COUNT] = {};
+
+        friend class Stats;
+    };
+
+    static ThreadStats &local() {
+        // trivially destructible, so it stays usable in thread_local destructors
+        thread_local ThreadStats *stats = nullptr;
+        if (stats == nullptr) {
+            stats = instance().acquire();
+            thread_local Releaser releaser(stats);
+        }
+        return *stats;
+    }
+
+    // sums counters of every thread that ever touched AtomicSharedPtr
+    static StatsSnapshot snapshot() {
+        uint64_t totals[COUNTER_COUNT] = {};
+        Stats &stats = instance();
+        std::lock_guard guard{stats.lock};
+        for (const auto &thread : stats.threads)
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                uint64_t value = thread->values[i].load(std::memory_order_relaxed);
+                totals[i] = i == MaxDestructionQueue ? std::max(totals[i], value) : totals[i] + value;
+            }
+
+        return {totals[CasAttempts], totals[CasFailures], totals[GetAborts], totals[LocalRefTransfers],
+                totals[CasRefTransfers], totals[DeferredDestructions], totals[MaxDestructionQueue]};
+    }
+
+    // starts maxima from zero, e.g. before measured run; owners may race with it and keep their value
+    static void resetMaxima() {
+        Stats &stats = instance();
+        std::lock_guard guard{stats.lock};
+        for (const auto &thread : stats.threads)
+            thread->values[MaxDestructionQueue].store(0, std::memory_order_relaxed);
+    }
+
+private:
+    // returns block of its thread to free list at thread exit
+    class Releaser {
+    public:
+        explicit Releaser(ThreadStats *&stats): stats(stats) {}
+        ~Releaser() {
+            instance().release(stats);
+            stats = instance().late;
+        }
+
+    private:
+        ThreadStats *&stats;
+    };
+
+    static Stats &instance() {
+        static Stats *stats = new Stats();
+        return *stats;
+    }
+
+    ThreadStats *acquire() {
+        std::lock_guard guard{lock};
+        if (!free.empty()) {
+            ThreadStats *res = free.back();
+            free.pop_back();
+            return res;
+        }
+
+        threads.push_back(std::make_unique<ThreadStats>());
+        return threads.back().get();
+    }
+
+    void release(ThreadStats *stats) {
+        std::lock_guard guard{lock};
+        free.push_back(stats);
+    }
+
+    Stats() {
+        threads.push_back(std::make_unique<ThreadStats>());
+        late = threads.back().get();
+    }
+
+    std::mutex lock;
+    std::vector<std::unique_ptr<ThreadStats>> threads;
+    std::vector<ThreadStats*> free;
+    // block of threads whose own block is already released
+    ThreadStats *late;
+};
+
+} // namespace LFStructs
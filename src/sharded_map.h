@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "atomic_shared_ptr.h"
+
+namespace LFStructs {
+
+// spreads keys by hash, merged iteration has to compare heads of every shard
+template<typename Key>
+struct HashRouter {
+    size_t operator()(const Key &key, size_t shardCount) const {
+        // std::hash is identity for integers, mix bits before taking modulo
+        size_t hash = std::hash<Key>()(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash % shardCount;
+    }
+};
+
+// shard i owns keys in [bounds[i - 1], bounds[i]), so every shard holds one key range
+template<typename Key>
+class RangeRouter {
+public:
+    RangeRouter() = default;
+    explicit RangeRouter(std::vector<Key> bounds): bounds(std::move(bounds)) {}
+
+    size_t operator()(const Key &key, size_t shardCount) const {
+        size_t shard = std::upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+        return std::min(shard, shardCount - 1);
+    }
+
+private:
+    std::vector<Key> bounds;
+};
+
+struct ShardStats {
+    size_t upserts;
+    size_t removes;
+    // zero if shard map can't report its size
+    size_t size;
+};
+
+/* Splits keys between N independent maps, so writers to different shards CAS
+ * different roots. Every shard lives on its own cache lines.
+ *
+ * Snapshot pins every shard one after another: each shard is a consistent
+ * version, but the whole snapshot is not a single point in time. Shard maps
+ * without Snapshot (LFHashMap, LFBTreeMap) work as well, just without
+ * snapshot() and iteration. */
+template<typename MapImpl, size_t N, typename Router = HashRouter<typename MapImpl::key_type>>
+class ShardedMap {
+    using Key = typename MapImpl::key_type;
+    using Value = typename MapImpl::mapped_type;
+
+    template<typename Map, typename = void>
+    struct HasSize : std::false_type {};
+    template<typename Map>
+    struct HasSize<Map, std::void_t<decltype(std::declval<Map&>().approxSize())>> : std::true_type {};
+
+    // stand-in for maps without snapshots, nested types using it are never completed then
+    struct NoSnapshot {
+        using Iterator = void;
+    };
+
+    template<typename Map, typename = void>
+    struct SnapshotOf {
+        using type = NoSnapshot;
+    };
+    template<typename Map>
+    struct SnapshotOf<Map, std::void_t<typename Map::Snapshot>> {
+        using type = typename Map::Snapshot;
+    };
+
+    using ShardSnapshot = typename SnapshotOf<MapImpl>::type;
+    using ShardIterator = typename ShardSnapshot::Iterator;
+
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        MapImpl map;
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> upserts = 0;
+        std::atomic<size_t> removes = 0;
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+
+    // merges ordered iterators of every shard
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<const Key&, const Value&>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        value_type operator*() const { return *parts[current].first; }
+        const Key& key() const { return parts[current].first.key(); }
+        const Value& value() const { return parts[current].first.value(); }
+
+        Iterator& operator++() {
+            ++parts[current].first;
+            findCurrent();
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        bool operator==(const Iterator &other) const {
+            if (current == N || other.current == N)
+                return current == other.current;
+            return current == other.current && parts[current].first == other.parts[current].first;
+        }
+        bool operator!=(const Iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        Iterator(): current(N) {}
+        explicit Iterator(std::array<std::pair<ShardIterator, ShardIterator>, N> parts)
+            : parts(std::move(parts))
+        {
+            findCurrent();
+        }
+
+        void findCurrent() {
+            current = N;
+            for (size_t i = 0; i < N; i++)
+                if (parts[i].first != parts[i].second &&
+                        (current == N || parts[i].first.key() < parts[current].first.key()))
+                    current = i;
+        }
+
+        std::array<std::pair<ShardIterator, ShardIterator>, N> parts;
+        size_t current;
+
+        friend class ShardedMap;
+    };
+
+    class Range {
+    public:
+        Iterator begin() const { return first; }
+        Iterator end() const { return {}; }
+
+    private:
+        explicit Range(Iterator first): first(std::move(first)) {}
+
+        Iterator first;
+
+        friend class ShardedMap;
+    };
+
+    class Snapshot {
+    public:
+        std::optional<Value> get(const Key &key) const { return shards[router(key, N)].get(key); }
+        const ShardSnapshot& shard(size_t index) const { return shards[index]; }
+        size_t size() const;
+
+        Iterator begin() const;
+        Iterator end() const { return {}; }
+        Iterator lowerBound(const Key &key) const;
+        // elements with lo <= key < hi
+        Range range(const Key &lo, const Key &hi) const;
+
+    private:
+        explicit Snapshot(Router router): router(std::move(router)) {}
+
+        Router router;
+        std::array<ShardSnapshot, N> shards;
+
+        friend class ShardedMap;
+    };
+
+    explicit ShardedMap(Router router = Router()): router(std::move(router)) {}
+
+    void upsert(Key key, Value value);
+    std::optional<Value> get(Key key);
+    void remove(Key key);
+
+    // only for shard maps with Snapshot
+    Snapshot snapshot();
+
+    size_t shardOf(const Key &key) const { return router(key, N); }
+    MapImpl& shard(size_t index) { return shards[index].map; }
+    ShardStats stats(size_t index);
+    // sum of shard sizes, zero if shard map can't report its size
+    size_t approxSize();
+
+private:
+    Router router;
+    Shard shards[N];
+};
+
+template<typename MapImpl, size_t N, typename Router>
+void ShardedMap<MapImpl, N, Router>::upsert(Key key, Value value) {
+    Shard &shard = shards[router(key, N)];
+    shard.upserts.fetch_add(1, std::memory_order_relaxed);
+    shard.map.upsert(key, value);
+}
+
+template<typename MapImpl, size_t N, typename Router>
+std::optional<typename ShardedMap<MapImpl, N, Router>::Value> ShardedMap<MapImpl, N, Router>::get(Key key) {
+    return shards[router(key, N)].map.get(key);
+}
+
+template<typename MapImpl, size_t N, typename Router>
+void ShardedMap<MapImpl, N, Router>::remove(Key key) {
+    Shard &shard = shards[router(key, N)];
+    shard.removes.fetch_add(1, std::memory_order_relaxed);
+    shard.map.remove(key);
+}
+
+template<typename MapImpl, size_t N, typename Router>
+typename ShardedMap<MapImpl, N, Router>::Snapshot ShardedMap<MapImpl, N, Router>::snapshot() {
+    static_assert(!std::is_same_v<ShardSnapshot, NoSnapshot>, "shard map has no snapshots");
+    Snapshot res(router);
+    for (size_t i = 0; i < N; i++)
+        res.shards[i] = shards[i].map.snapshot();
+
+    return res;
+}
+
+template<typename MapImpl, size_t N, typename Router>
+ShardStats ShardedMap<MapImpl, N, Router>::stats(size_t index) {
+    Shard &shard = shards[index];
+    ShardStats res{shard.upserts.load(std::memory_order_relaxed), shard.removes.load(std::memory_order_relaxed), 0};
+    if constexpr (HasSize<MapImpl>::value)
+        res.size = shard.map.approxSize();
+
+    return res;
+}
+
+template<typename MapImpl, size_t N, typename Router>
+size_t ShardedMap<MapImpl, N, Router>::approxSize() {
+    size_t res = 0;
+    for (size_t i = 0; i < N; i++)
+        res += stats(i).size;
+
+    return res;
+}
+
+template<typename MapImpl, size_t N, typename Router>
+size_t ShardedMap<MapImpl, N, Router>::Snapshot::size() const {
+    size_t res = 0;
+    for (const ShardSnapshot &shard : shards)
+        res += shard.size();
+
+    return res;
+}
+
+template<typename MapImpl, size_t N, typename Router>
+typename ShardedMap<MapImpl, N, Router>::Iterator ShardedMap<MapImpl, N, Router>::Snapshot::begin() const {
+    std::array<std::pair<ShardIterator, ShardIterator>, N> parts;
+    for (size_t i = 0; i < N; i++)
+        parts[i] = {shards[i].begin(), shards[i].end()};
+
+    return Iterator(std::move(parts));
+}
+
+template<typename MapImpl, size_t N, typename Router>
+typename ShardedMap<MapImpl, N, Router>::Iterator ShardedMap<MapImpl, N, Router>::Snapshot::lowerBound(const Key &key) const {
+    std::array<std::pair<ShardIterator, ShardIterator>, N> parts;
+    for (size_t i = 0; i < N; i++)
+        parts[i] = {shards[i].lowerBound(key), shards[i].end()};
+
+    return Iterator(std::move(parts));
+}
+
+template<typename MapImpl, size_t N, typename Router>
+typename ShardedMap<MapImpl, N, Router>::Range ShardedMap<MapImpl, N, Router>::Snapshot::range(const Key &lo, const Key &hi) const {
+    std::array<std::pair<ShardIterator, ShardIterator>, N> parts;
+    for (size_t i = 0; i < N; i++) {
+        auto shardRange = shards[i].range(lo, hi);
+        parts[i] = {shardRange.begin(), shardRange.end()};
+    }
+
+    return Range(Iterator(std::move(parts)));
+}
+
+} // namespace LFStructs
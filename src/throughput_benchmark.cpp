@@ -0,0 +1,644 @@
+/* Fixed-duration throughput of every container under YCSB-style mixes.
+ *
+ * Usage: ThroughputBenchmark [--duration=2] [--warmup=0.5] [--threads=1,2,4]
+ *                            [--keys=1000000] [--workloads=A,B,C] [--distributions=uniform,zipf]
+ *                            [--containers=LFMap,LFQueue,...] [--cache-sizes=1,10] [--pin]
+ *                            [--format=text|csv|json]
+ *
+ * Every worker owns its random generator, so threads never meet anywhere but
+ * inside the container. Workers run warmup first, then count operations until
+ * duration expires. Map workloads read and upsert keys preloaded into the map:
+ * A is 50% reads, B is 95% reads, C is read only, a plain number is read percent.
+ * Zipfian keys follow YCSB (theta 0.99, ranks scrambled over the key space).
+ * Queues, stacks and priority queues run 50/50 push/pop.
+ * Caches are read-through over the same keys, sized in percent of --keys,
+ * and report hit rate next to throughput.
+ *
+ * Built with -DENABLE_LATENCY_HISTOGRAMS=ON, containers record latency of every
+ * push/pop/get/upsert/remove and p50/p90/p99/p999/max are printed per operation.
+ * With -DENABLE_POINTER_STATS=ON contention and reclamation counters of
+ * AtomicSharedPtr are printed for every run. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <stack>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "lfqueue.h"
+#include "lfstack.h"
+#include "lfmap.h"
+#include "lfmap_avl.h"
+#include "lfbtree_map.h"
+#include "lfskiplist_map.h"
+#include "lfhash_map.h"
+#include "sharded_map.h"
+#include "lfpriority_queue.h"
+#include "concurrent_cache.h"
+#include "benchmark_harness.h"
+
+namespace {
+
+using Benchmark::Random;
+
+enum class Distribution { Uniform, Zipf };
+
+/* Gray et al. "Quickly Generating Billion-Record Synthetic Databases", as in
+ * YCSB ZipfianGenerator. zeta(n) is computed once, next() is O(1). */
+class KeyGenerator {
+public:
+    KeyGenerator(Distribution distribution, uint64_t keyCount, double theta = 0.99)
+        : distribution(distribution)
+        , keyCount(keyCount)
+    {
+        if (distribution != Distribution::Zipf)
+            return;
+
+        double zeta2 = 1 + std::pow(0.5, theta);
+        for (uint64_t i = 1; i <= keyCount; i++)
+            zetan += 1 / std::pow(double(i), theta);
+        alpha = 1 / (1 - theta);
+        eta = (1 - std::pow(2.0 / keyCount, 1 - theta)) / (1 - zeta2 / zetan);
+        halfPowTheta = 1 + std::pow(0.5, theta);
+    }
+
+    int next(Random &random) const {
+        if (distribution == Distribution::Uniform)
+            return int(random.next() % keyCount);
+
+        double u = random.nextDouble();
+        double uz = u * zetan;
+        uint64_t rank;
+        if (uz < 1)
+            rank = 0;
+        else if (uz < halfPowTheta)
+            rank = 1;
+        else
+            rank = std::min<uint64_t>(keyCount - 1, uint64_t(keyCount * std::pow(eta * u - eta + 1, alpha)));
+
+        // hot ranks would be neighbouring keys otherwise
+        return int(fnv64(rank) % keyCount);
+    }
+
+private:
+    static uint64_t fnv64(uint64_t value) {
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < 8; i++) {
+            hash ^= value & 0xff;
+            hash *= 0x100000001b3ULL;
+            value >>= 8;
+        }
+        return hash;
+    }
+
+    Distribution distribution;
+    uint64_t keyCount;
+    double zetan = 0;
+    double alpha = 0;
+    double eta = 0;
+    double halfPowTheta = 0;
+};
+
+struct Config : Benchmark::Options {
+    Config(): Options(2, 0.5) {}
+
+    int keyCount = 1000000;
+    std::vector<std::string> workloads = {"A", "B", "C"};
+    std::vector<std::string> distributions = {"uniform", "zipf"};
+    std::vector<std::string> containers;
+    // cache capacities in percent of keyCount
+    std::vector<int> cacheSizes = {1, 10};
+};
+
+struct LatencyPercentiles {
+    LFStructs::LatencyOp op;
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+struct Result {
+    std::string container;
+    std::string workload;
+    std::string distribution;
+    int threads;
+    double seconds;
+    uint64_t ops;
+    uint64_t minThreadOps;
+    uint64_t maxThreadOps;
+    // share of cache lookups which hit, negative for other containers
+    double hitRate = -1;
+    // filled only when built with LATENCY_HISTOGRAMS_ENABLED
+    std::vector<LatencyPercentiles> latencies;
+    // all zeros unless built with POINTER_STATS_ENABLED
+    LFStructs::StatsSnapshot pointerStats = {};
+};
+
+bool selected(const Config &config, const char *name) {
+    return config.containers.empty() ||
+           std::find(config.containers.begin(), config.containers.end(), name) != config.containers.end();
+}
+
+#if LATENCY_HISTOGRAMS_ENABLED
+using LatencySnapshot = std::vector<LFStructs::LatencyHistogram>;
+
+LatencySnapshot latencySnapshot() {
+    LatencySnapshot res;
+    for (int op = 0; op < int(LFStructs::LatencyOp::Count); op++)
+        res.push_back(LFStructs::latencyHistogram(LFStructs::LatencyOp(op)));
+    return res;
+}
+
+// percentiles of operations recorded between two snapshots
+std::vector<LatencyPercentiles> latencyPercentiles(const LatencySnapshot &before, LatencySnapshot after) {
+    std::vector<LatencyPercentiles> res;
+    for (int op = 0; op < int(LFStructs::LatencyOp::Count); op++) {
+        LFStructs::LatencyHistogram &histogram = after[op];
+        histogram.subtract(before[op]);
+        if (histogram.count() == 0)
+            continue;
+
+        res.push_back({LFStructs::LatencyOp(op), histogram.count(),
+                       histogram.valueAtPercentile(50), histogram.valueAtPercentile(90),
+                       histogram.valueAtPercentile(99), histogram.valueAtPercentile(99.9),
+                       histogram.max()});
+    }
+    return res;
+}
+#endif
+
+class Printer {
+public:
+    explicit Printer(const std::string &format): format(format) {
+        if (format == "csv")
+            printf("container,workload,distribution,threads,seconds,ops,mops,mops_per_thread,min_thread_mops,max_thread_mops,hit_rate%s%s\n",
+                   POINTER_STATS_ENABLED ? ",cas_attempts,cas_failures,get_aborts,local_ref_transfers,cas_ref_transfers,"
+                                           "deferred_destructions,max_destruction_queue" : "",
+                   LATENCY_HISTOGRAMS_ENABLED ? ",op,op_count,p50_ns,p90_ns,p99_ns,p999_ns,max_ns" : "");
+        else if (format == "json")
+            printf("[");
+        else
+            printf("%-26s %-9s %-8s %7s %10s %12s %10s %10s\n",
+                   "container", "workload", "keys", "threads", "Mop/s", "Mop/s/thr", "min thr", "max thr");
+    }
+
+    ~Printer() {
+        if (format == "json")
+            printf("\n]\n");
+    }
+
+    void print(const Result &result) {
+        double mops = result.ops / result.seconds / 1e6;
+        double minMops = result.minThreadOps / result.seconds / 1e6;
+        double maxMops = result.maxThreadOps / result.seconds / 1e6;
+        if (format == "csv") {
+            // one row per operation type when latencies are recorded
+            size_t rows = std::max<size_t>(1, result.latencies.size());
+            for (size_t i = 0; i < rows; i++) {
+                printf("%s,%s,%s,%d,%.3f,%llu,%.4f,%.4f,%.4f,%.4f",
+                       result.container.c_str(), result.workload.c_str(), result.distribution.c_str(),
+                       result.threads, result.seconds, (unsigned long long)result.ops,
+                       mops, mops / result.threads, minMops, maxMops);
+                if (result.hitRate >= 0)
+                    printf(",%.4f", result.hitRate);
+                else
+                    printf(",");
+                if (POINTER_STATS_ENABLED) {
+                    const LFStructs::StatsSnapshot &stats = result.pointerStats;
+                    printf(",%llu,%llu,%llu,%llu,%llu,%llu,%llu",
+                           (unsigned long long)stats.casAttempts, (unsigned long long)stats.casFailures,
+                           (unsigned long long)stats.getAborts, (unsigned long long)stats.localRefTransfers,
+                           (unsigned long long)stats.casRefTransfers, (unsigned long long)stats.deferredDestructions,
+                           (unsigned long long)stats.maxDestructionQueue);
+                }
+                if (i < result.latencies.size()) {
+                    const LatencyPercentiles &latency = result.latencies[i];
+                    printf(",%s,%llu,%llu,%llu,%llu,%llu,%llu", LFStructs::latencyOpName(latency.op),
+                           (unsigned long long)latency.count, (unsigned long long)latency.p50,
+                           (unsigned long long)latency.p90, (unsigned long long)latency.p99,
+                           (unsigned long long)latency.p999, (unsigned long long)latency.max);
+                } else if (LATENCY_HISTOGRAMS_ENABLED) {
+                    printf(",,,,,,,");
+                }
+                printf("\n");
+            }
+        } else if (format == "json") {
+            printf("%s\n  {\"container\": \"%s\", \"workload\": \"%s\", \"distribution\": \"%s\", "
+                   "\"threads\": %d, \"seconds\": %.3f, \"ops\": %llu, \"mops\": %.4f, "
+                   "\"mops_per_thread\": %.4f, \"min_thread_mops\": %.4f, \"max_thread_mops\": %.4f",
+                   first ? "" : ",",
+                   result.container.c_str(), result.workload.c_str(), result.distribution.c_str(),
+                   result.threads, result.seconds, (unsigned long long)result.ops,
+                   mops, mops / result.threads, minMops, maxMops);
+            if (result.hitRate >= 0)
+                printf(", \"hit_rate\": %.4f", result.hitRate);
+            if (!result.latencies.empty()) {
+                printf(", \"latency_ns\": {");
+                for (size_t i = 0; i < result.latencies.size(); i++) {
+                    const LatencyPercentiles &latency = result.latencies[i];
+                    printf("%s\"%s\": {\"count\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+                           "\"p999\": %llu, \"max\": %llu}",
+                           i ? ", " : "", LFStructs::latencyOpName(latency.op),
+                           (unsigned long long)latency.count, (unsigned long long)latency.p50,
+                           (unsigned long long)latency.p90, (unsigned long long)latency.p99,
+                           (unsigned long long)latency.p999, (unsigned long long)latency.max);
+                }
+                printf("}");
+            }
+            if (POINTER_STATS_ENABLED) {
+                const LFStructs::StatsSnapshot &stats = result.pointerStats;
+                printf(", \"pointer_stats\": {\"cas_attempts\": %llu, \"cas_failures\": %llu, \"get_aborts\": %llu, "
+                       "\"local_ref_transfers\": %llu, \"cas_ref_transfers\": %llu, \"deferred_destructions\": %llu, "
+                       "\"max_destruction_queue\": %llu}",
+                       (unsigned long long)stats.casAttempts, (unsigned long long)stats.casFailures,
+                       (unsigned long long)stats.getAborts, (unsigned long long)stats.localRefTransfers,
+                       (unsigned long long)stats.casRefTransfers, (unsigned long long)stats.deferredDestructions,
+                       (unsigned long long)stats.maxDestructionQueue);
+            }
+            printf("}");
+        } else {
+            printf("%-26s %-9s %-8s %7d %10.3f %12.3f %10.3f %10.3f\n",
+                   result.container.c_str(), result.workload.c_str(), result.distribution.c_str(),
+                   result.threads, mops, mops / result.threads, minMops, maxMops);
+            if (result.hitRate >= 0)
+                printf("    hit rate %.2f%%\n", 100 * result.hitRate);
+            if (POINTER_STATS_ENABLED) {
+                const LFStructs::StatsSnapshot &stats = result.pointerStats;
+                printf("    CAS %llu (%.2f%% failed)  get aborts %llu  ref transfers %llu local / %llu in CAS  "
+                       "deferred destructions %llu (max queue %llu)\n",
+                       (unsigned long long)stats.casAttempts,
+                       stats.casAttempts ? 100.0 * stats.casFailures / stats.casAttempts : 0.0,
+                       (unsigned long long)stats.getAborts, (unsigned long long)stats.localRefTransfers,
+                       (unsigned long long)stats.casRefTransfers, (unsigned long long)stats.deferredDestructions,
+                       (unsigned long long)stats.maxDestructionQueue);
+            }
+            for (const LatencyPercentiles &latency : result.latencies)
+                printf("    %-8s p50 %8llu ns  p90 %8llu ns  p99 %8llu ns  p999 %8llu ns  max %10llu ns\n",
+                       LFStructs::latencyOpName(latency.op),
+                       (unsigned long long)latency.p50, (unsigned long long)latency.p90,
+                       (unsigned long long)latency.p99, (unsigned long long)latency.p999,
+                       (unsigned long long)latency.max);
+        }
+        first = false;
+        fflush(stdout);
+    }
+
+private:
+    std::string format;
+    bool first = true;
+};
+
+/* Runs op(random, threadIndex) like Benchmark::runThreads and collects
+ * latencies and pointer stats of measured part, if they are compiled in. */
+template<typename Op>
+Result runThreads(const Config &config, int threadCount, Op op, Benchmark::RunHooks hooks = {}) {
+#if LATENCY_HISTOGRAMS_ENABLED
+    LatencySnapshot latencyBefore;
+#endif
+#if POINTER_STATS_ENABLED
+    LFStructs::StatsSnapshot statsBefore;
+#endif
+    // operations finishing around phase switches may fall on either side, like counted batches
+    hooks.beforeMeasure = [&](){
+#if LATENCY_HISTOGRAMS_ENABLED
+        latencyBefore = latencySnapshot();
+#endif
+#if POINTER_STATS_ENABLED
+        LFStructs::Stats::resetMaxima();
+        statsBefore = LFStructs::Stats::snapshot();
+#endif
+    };
+    Benchmark::RunResult run = Benchmark::runThreads(config, threadCount, op, hooks);
+
+    Result res;
+#if LATENCY_HISTOGRAMS_ENABLED
+    // latencies of stop phase batches are included, they are at most BATCH operations per thread
+    res.latencies = latencyPercentiles(latencyBefore, latencySnapshot());
+#endif
+#if POINTER_STATS_ENABLED
+    res.pointerStats = LFStructs::Stats::snapshot() - statsBefore;
+#endif
+    res.threads = threadCount;
+    res.seconds = run.seconds;
+    res.ops = run.ops();
+    res.minThreadOps = *std::min_element(run.threadOps.begin(), run.threadOps.end());
+    res.maxThreadOps = *std::max_element(run.threadOps.begin(), run.threadOps.end());
+    return res;
+}
+
+template<typename StdMap>
+class LockedMap {
+public:
+    void upsert(int key, int value) {
+        LATENCY_SCOPE(LFStructs::LatencyOp::Upsert);
+        std::lock_guard<std::mutex> guard(mutex);
+        map[key] = value;
+    }
+
+    std::optional<int> get(int key) {
+        LATENCY_SCOPE(LFStructs::LatencyOp::Get);
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = map.find(key);
+        if (it == map.end())
+            return {};
+        return it->second;
+    }
+
+private:
+    std::mutex mutex;
+    StdMap map;
+};
+
+template<typename StdContainer>
+class LockedSequence {
+public:
+    void push(int value) {
+        LATENCY_SCOPE(LFStructs::LatencyOp::Push);
+        std::lock_guard<std::mutex> guard(mutex);
+        container.push(value);
+    }
+
+    std::optional<int> pop() {
+        LATENCY_SCOPE(LFStructs::LatencyOp::Pop);
+        std::lock_guard<std::mutex> guard(mutex);
+        if (container.empty())
+            return {};
+        int res = top(container);
+        container.pop();
+        return res;
+    }
+
+private:
+    template<typename C>
+    static auto top(const C &c) -> decltype(c.top()) { return c.top(); }
+    template<typename C>
+    static auto top(const C &c) -> decltype(c.front()) { return c.front(); }
+
+    std::mutex mutex;
+    StdContainer container;
+};
+
+// push/pop facade over priority queue, relaxed version gets two heaps per thread
+template<bool Relaxed>
+class PriorityQueueAdapter {
+public:
+    explicit PriorityQueueAdapter(int threadCount): queue(Relaxed ? 2 * threadCount : 1) {}
+
+    void push(int value) { queue.push(value, value); }
+    std::optional<int> pop() {
+        auto res = queue.popMin();
+        if (!res)
+            return {};
+        return res->second;
+    }
+
+private:
+    LFStructs::LFPriorityQueue<int, int> queue;
+};
+
+// LRU list under one mutex, the usual starting point for a shared cache
+template<typename Key, typename Value>
+class LockedLruCache {
+public:
+    explicit LockedLruCache(size_t capacity): capacity(std::max<size_t>(capacity, 1)) {}
+
+    std::shared_ptr<Value> get(const Key &key) {
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = index.find(key);
+        if (it == index.end())
+            return {};
+        order.splice(order.begin(), order, it->second);
+        return it->second->second;
+    }
+
+    void put(const Key &key, Value value) {
+        auto shared = std::make_shared<Value>(std::move(value));
+        std::lock_guard<std::mutex> guard(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = std::move(shared);
+            order.splice(order.begin(), order, it->second);
+            return;
+        }
+
+        if (index.size() == capacity) {
+            index.erase(order.back().first);
+            order.pop_back();
+        }
+        order.emplace_front(key, std::move(shared));
+        index[key] = order.begin();
+    }
+
+private:
+    using Order = std::list<std::pair<Key, std::shared_ptr<Value>>>;
+
+    std::mutex mutex;
+    size_t capacity;
+    // most recently used first
+    Order order;
+    std::unordered_map<Key, typename Order::iterator> index;
+};
+
+int readPercent(const std::string &workload) {
+    if (workload == "A")
+        return 50;
+    if (workload == "B")
+        return 95;
+    if (workload == "C")
+        return 100;
+    return std::clamp(atoi(workload.c_str()), 0, 100);
+}
+
+/* One map is preloaded with every key and reused for all runs: workloads only
+ * read and overwrite existing keys, so its shape doesn't change between runs. */
+template<typename Map>
+void benchmarkMap(const char *name, const Config &config, Printer &printer) {
+    if (!selected(config, name))
+        return;
+
+    std::unique_ptr<Map> map(new Map());
+    for (int key = 0; key < config.keyCount; key++)
+        map->upsert(key, key);
+
+    for (const std::string &distributionName : config.distributions) {
+        Distribution distribution = distributionName == "zipf" ? Distribution::Zipf : Distribution::Uniform;
+        KeyGenerator keys(distribution, config.keyCount);
+        for (const std::string &workload : config.workloads) {
+            uint64_t readThreshold = readPercent(workload);
+            for (int threadCount : config.threadCounts) {
+                Result result = runThreads(config, threadCount, [&map, &keys, readThreshold](Random &random, int){
+                    int key = keys.next(random);
+                    if (random.next() % 100 < readThreshold) {
+                        if (!map->get(key))
+                            abort();
+                    } else {
+                        map->upsert(key, int(random.next()));
+                    }
+                });
+                result.container = name;
+                result.workload = workload;
+                result.distribution = distributionName;
+                printer.print(result);
+            }
+        }
+    }
+}
+
+/* Read-through cache: every lookup which misses puts its key. Fresh cache is
+ * filled single-threaded before each run, so hit rate is close to steady one. */
+template<typename Cache>
+void benchmarkCache(const char *name, const Config &config, Printer &printer) {
+    if (!selected(config, name))
+        return;
+
+    struct alignas(LFStructs::CACHE_LINE_SIZE) ThreadHits {
+        uint64_t lookups = 0;
+        uint64_t hits = 0;
+    };
+
+    for (const std::string &distributionName : config.distributions) {
+        Distribution distribution = distributionName == "zipf" ? Distribution::Zipf : Distribution::Uniform;
+        KeyGenerator keys(distribution, config.keyCount);
+        for (int percent : config.cacheSizes) {
+            size_t capacity = std::max<size_t>(1, size_t(config.keyCount) * percent / 100);
+            for (int threadCount : config.threadCounts) {
+                std::unique_ptr<Cache> cache(new Cache(capacity));
+                Random fill(0xf111ULL);
+                for (size_t i = 0; i < 4 * capacity; i++) {
+                    int key = keys.next(fill);
+                    if (cache->get(key).get() == nullptr)
+                        cache->put(key, key);
+                }
+
+                std::vector<ThreadHits> hits(threadCount);
+                // warmup lookups are not counted, like warmup operations
+                Benchmark::RunHooks hooks;
+                hooks.measureStarted = [&hits](int thread){ hits[thread] = ThreadHits(); };
+                Result result = runThreads(config, threadCount, [&cache, &keys, &hits](Random &random, int thread){
+                    int key = keys.next(random);
+                    ThreadHits &counter = hits[thread];
+                    counter.lookups++;
+                    auto value = cache->get(key);
+                    if (value.get() == nullptr) {
+                        cache->put(key, key);
+                    } else {
+                        if (*value.get() != key)
+                            abort();
+                        counter.hits++;
+                    }
+                }, hooks);
+
+                uint64_t lookups = 0;
+                uint64_t hitCount = 0;
+                for (const ThreadHits &counter : hits) {
+                    lookups += counter.lookups;
+                    hitCount += counter.hits;
+                }
+                result.hitRate = lookups ? double(hitCount) / lookups : 0;
+                result.container = name;
+                result.workload = std::to_string(percent) + "%";
+                result.distribution = distributionName;
+                printer.print(result);
+            }
+        }
+    }
+}
+
+template<typename Container>
+void benchmarkSequence(const char *name, const Config &config, Printer &printer) {
+    if (!selected(config, name))
+        return;
+
+    static const int PREFILL = 1000;
+    for (int threadCount : config.threadCounts) {
+        std::unique_ptr<Container> container;
+        if constexpr (std::is_constructible_v<Container, int>)
+            container.reset(new Container(threadCount));
+        else
+            container.reset(new Container());
+        for (int i = 0; i < PREFILL; i++)
+            container->push(i);
+
+        Result result = runThreads(config, threadCount, [&container](Random &random, int){
+            uint64_t value = random.next();
+            if (value & 1)
+                container->push(int(value >> 33));
+            else
+                container->pop();
+        });
+        result.container = name;
+        result.workload = "push/pop";
+        result.distribution = "-";
+        printer.print(result);
+    }
+}
+
+Config parseArguments(int argc, char **argv) {
+    Config config;
+    Benchmark::parseArguments(argc, argv, config, [&config](const std::string &name, const std::string &value){
+        if (name == "--keys") {
+            config.keyCount = std::max(1, atoi(value.c_str()));
+        } else if (name == "--workloads") {
+            config.workloads = Benchmark::split(value);
+        } else if (name == "--distributions") {
+            config.distributions = Benchmark::split(value);
+        } else if (name == "--containers") {
+            config.containers = Benchmark::split(value);
+        } else if (name == "--cache-sizes") {
+            config.cacheSizes.clear();
+            for (const std::string &percent : Benchmark::split(value))
+                config.cacheSizes.push_back(std::clamp(atoi(percent.c_str()), 1, 100));
+        } else {
+            return false;
+        }
+        return true;
+    });
+
+    return config;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Config config = parseArguments(argc, argv);
+    Printer printer(config.format);
+
+    benchmarkMap<LFStructs::LFMap<int, int>>("LFMap", config, printer);
+    benchmarkMap<LFStructs::LFMapAvl<int, int>>("LFMapAvl", config, printer);
+    benchmarkMap<LFStructs::LFBTreeMap<int, int>>("LFBTreeMap", config, printer);
+    benchmarkMap<LFStructs::LFSkipListMap<int, int>>("LFSkipListMap", config, printer);
+    benchmarkMap<LFStructs::LFHashMap<int, int>>("LFHashMap", config, printer);
+    benchmarkMap<LFStructs::ShardedMap<LFStructs::LFMap<int, int>, 16>>("ShardedLFMap", config, printer);
+    benchmarkMap<LockedMap<std::map<int, int>>>("std::map+mutex", config, printer);
+    benchmarkMap<LockedMap<std::unordered_map<int, int>>>("std::unordered_map+mutex", config, printer);
+
+    benchmarkCache<LFStructs::ConcurrentCache<int, int>>("ConcurrentCache", config, printer);
+    benchmarkCache<LockedLruCache<int, int>>("LRU+mutex", config, printer);
+
+    benchmarkSequence<LFStructs::LFQueue<int>>("LFQueue", config, printer);
+    benchmarkSequence<LockedSequence<std::queue<int>>>("std::queue+mutex", config, printer);
+    benchmarkSequence<LFStructs::LFStack<int>>("LFStack", config, printer);
+    benchmarkSequence<LockedSequence<std::stack<int>>>("std::stack+mutex", config, printer);
+    benchmarkSequence<PriorityQueueAdapter<false>>("LFPriorityQueue", config, printer);
+    benchmarkSequence<PriorityQueueAdapter<true>>("LFPriorityQueue/relaxed", config, printer);
+    benchmarkSequence<LockedSequence<std::priority_queue<int>>>("std::priority_queue+mutex", config, printer);
+
+    return 0;
+}
@@ -0,0 +1,159 @@
+/* Converts trace file written by FastLogger::StartStreaming to Chrome trace
+ * JSON, which opens in chrome://tracing or ui.perfetto.dev.
+ *
+ * Usage: TraceConverter <trace file> [output.json = stdout] [--by-cpu] [--ticks-per-us=N]
+ *
+ * Every logging thread gets its own track (or every cpu with --by-cpu, to see
+ * migrations), every event is an instant event named after Operation::Type or
+ * registered user type, with both payload words and cpu in args. Timestamps
+ * are converted with TSC frequency calibrated by writing process, unless
+ * --ticks-per-us overrides it. */
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fast_logger_format.h"
+
+using LFStructs::Operation;
+using LFStructs::TraceChunk;
+using LFStructs::TraceEvent;
+using LFStructs::TraceFileHeader;
+
+namespace {
+
+int fail(const char *message, const char *path) {
+    fprintf(stderr, "%s: %s\n", path, message);
+    return 1;
+}
+
+std::string typeName(const TraceFileHeader &header, uint32_t type) {
+    if (const char *name = Operation::name(type))
+        return name;
+
+    uint32_t userIndex = type - Operation::User;
+    if (type >= Operation::User && userIndex < LFStructs::MAX_USER_EVENT_TYPES && header.userTypeNames[userIndex][0]) {
+        const char *name = header.userTypeNames[userIndex];
+        return std::string(name, strnlen(name, LFStructs::USER_EVENT_NAME_SIZE));
+    }
+
+    return "type " + std::to_string(type);
+}
+
+// registered names are arbitrary strings, quotes, backslashes and control characters would break JSON
+std::string jsonEscaped(const std::string &text) {
+    std::string res;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            res += escaped;
+        } else {
+            res += c;
+        }
+    }
+
+    return res;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *inputPath = nullptr;
+    const char *outputPath = nullptr;
+    double ticksPerMicrosecond = 0;
+    bool byCpu = false;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--ticks-per-us=", 15) == 0)
+            ticksPerMicrosecond = atof(argv[i] + 15);
+        else if (strcmp(argv[i], "--by-cpu") == 0)
+            byCpu = true;
+        else if (inputPath == nullptr)
+            inputPath = argv[i];
+        else
+            outputPath = argv[i];
+    }
+    if (inputPath == nullptr || ticksPerMicrosecond < 0) {
+        fprintf(stderr, "usage: %s <trace file> [output.json] [--by-cpu] [--ticks-per-us=N]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(inputPath, O_RDONLY);
+    if (fd < 0)
+        return fail("can't open", inputPath);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < LFStructs::TRACE_HEADER_SIZE)
+        return fail("too small for trace file", inputPath);
+    size_t fileSize = info.st_size;
+    void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return fail("can't map", inputPath);
+
+    const TraceFileHeader *header = static_cast<const TraceFileHeader*>(mapping);
+    if (memcmp(header->magic, LFStructs::TRACE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+            header->chunkEvents != LFStructs::TRACE_CHUNK_EVENTS || header->eventSize != sizeof(TraceEvent))
+        return fail("not a trace file of this version", inputPath);
+    if (ticksPerMicrosecond == 0)
+        ticksPerMicrosecond = header->ticksPerNanosecond * 1000;
+    if (!(ticksPerMicrosecond > 0))
+        return fail("has no TSC calibration, pass --ticks-per-us", inputPath);
+
+    // file may be cut if process died while it was created
+    size_t chunkCount = std::min<uint64_t>({header->chunkCount, header->usedChunks.load(),
+                                            (fileSize - LFStructs::TRACE_HEADER_SIZE) / sizeof(TraceChunk)});
+    const TraceChunk *chunks = reinterpret_cast<const TraceChunk*>(static_cast<const char*>(mapping) + LFStructs::TRACE_HEADER_SIZE);
+
+    // chunks are taken in increasing order, so per-thread order is kept
+    std::map<uint32_t, std::vector<const TraceEvent*>> tracks;
+    uint64_t startTime = UINT64_MAX;
+    for (size_t i = 0; i < chunkCount; i++) {
+        uint32_t count = std::min(chunks[i].count.load(), LFStructs::TRACE_CHUNK_EVENTS);
+        for (uint32_t j = 0; j < count; j++) {
+            const TraceEvent &event = chunks[i].events[j];
+            tracks[byCpu ? event.cpu : chunks[i].thread].push_back(&event);
+            startTime = std::min(startTime, event.time);
+        }
+    }
+
+    FILE *output = outputPath ? fopen(outputPath, "w") : stdout;
+    if (output == nullptr)
+        return fail("can't create", outputPath);
+
+    size_t eventCount = 0;
+    fprintf(output, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(output, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"LFStructs\"}}");
+    for (const auto &[track, events] : tracks) {
+        fprintf(output, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %" PRIu32 ", "
+                        "\"args\": {\"name\": \"%s %" PRIu32 "\"}}", track, byCpu ? "cpu" : "thread", track);
+        for (const TraceEvent *event : events) {
+            fprintf(output, ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %" PRIu32 ", "
+                            "\"ts\": %.3f, \"args\": {\"address\": \"0x%016" PRIx64 "\", \"value\": %" PRIu64 ", "
+                            "\"cpu\": %" PRIu32 "}}",
+                    jsonEscaped(typeName(*header, event->type)).c_str(), track,
+                    (event->time - startTime) / ticksPerMicrosecond, event->address, event->value, event->cpu);
+            eventCount++;
+        }
+    }
+    fprintf(output, "\n]}\n");
+
+    if (outputPath)
+        fclose(output);
+    fprintf(stderr, "%zu events on %zu tracks, %" PRIu64 " events dropped\n",
+            eventCount, tracks.size(), header->droppedEvents.load());
+    munmap(mapping, fileSize);
+    return 0;
+}